@@ -7,6 +7,10 @@
 
 typedef int32 uis_device_id;
 
+// sent to loopers registered with BUISRoster::StartWatching(), with
+// "opcode" set to one of the values below
+#define B_UIS_DEVICE_EVENT '_UDE'
+
 enum {
 	B_UIS_DEVICE_ADDED = 1,
 	B_UIS_DEVICE_REMOVED,
@@ -32,9 +36,17 @@ public:
 	static BUISDevice*	FindByName(const char* name);
 
 						BUISRoster();
-							// TODO: add optional filter functionality
+						BUISRoster(uint16 usagePage, uint16 usageId);
+							// only devices of the given application usage
 	virtual				~BUISRoster();
 
+	status_t			AddUsageFilter(uint16 usagePage, uint16 usageId);
+							// only devices of one of the added application
+							// usages
+	status_t			AddItemFilter(uint16 usagePage, uint16 usageId,
+							uint8 type = UIS_TYPE_INPUT);
+							// only devices having such an item
+
 	status_t			GetNextDevice(BUISDevice** device);
 	void				Rewind();
 
@@ -44,8 +56,16 @@ public:
 	void				StopWatching();
 
 private:
-	uis_device_id		fCookie;
-	void*				fTarget;
+	struct Data;
+
+	BMessage*			_Filter();
+	status_t			_FetchDevices();
+
+	int32				fCookie;
+	Data*				fData;
+							// the watch target, the filter and the devices,
+							// in the place of the target of the first
+							// version, so that the class keeps its size
 };
 
 
@@ -128,6 +148,17 @@ public:
 
 	status_t			SetTarget(BLooper *looper);
 	status_t			SetTarget(BLooper *looper, void *cookie);
+	status_t			SetTarget(BLooper *looper, void *cookie,
+							float minimumDelta, float maximumRate);
+							// skips changes smaller than minimumDelta and
+							// sends at most maximumRate events per second,
+							// 0 means no limit
+
+	status_t			SetFilter(float deadzone, float hysteresis);
+							// noise filter applied by the driver, in the
+							// -1..1 range of the values, kept for the
+							// device across restarts
+	status_t			GetFilter(float& deadzone, float& hysteresis);
 
 private:
 						BUISItem(BUISReport* report, int32 item,
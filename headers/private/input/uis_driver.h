@@ -13,6 +13,19 @@ enum {
 	UIS_READ,
 	UIS_SEND,
 	UIS_STOP,
+	UIS_LAYOUT_INFO,
+	UIS_SET_FILTER,
+	UIS_GET_FILTER,
+	UIS_SET_IDLE,
+	UIS_GET_IDLE,
+	UIS_SET_POLL_INTERVAL,
+	UIS_GET_POLL_INFO,
+	UIS_READ_RAW,
+	UIS_DESCRIPTOR_INFO,
+	UIS_DUMP_DESCRIPTOR,
+	UIS_SET_INTEREST,
+	UIS_GET_STATS,
+	UIS_GET_VALUE,
 };
 
 
@@ -72,13 +85,20 @@ typedef struct {
 } uis_item_data;
 
 
+// timestamp is when the report came in, written when the record was put
+// into the ring buffer
 typedef struct _uis_report_data {
 	void *			report;
 	int32			items;
+	bigtime_t		timestamp;
+	bigtime_t		written;
 	uis_item_data	item[0];
 } uis_report_data;
 
 
+// UIS_STRING_INFO returns the length of the string if string is NULL, and
+// otherwise copies at most length bytes of it and sets length to the bytes
+// copied. The string isn't null terminated.
 typedef struct {
 	uint32	id;
 	int32	length;
@@ -87,4 +107,169 @@ typedef struct {
 } uis_string_info;
 
 
+enum {
+	UIS_ITEM_RELATIVE	= 0x01,
+	UIS_ITEM_ARRAY		= 0x02,
+	UIS_ITEM_HAS_DATA	= 0x04,
+};
+
+
+typedef struct {
+	void *		item;
+	uis_usage	usage;
+	uint32		flags;
+	int32		minimum;
+	int32		maximum;
+} uis_item_layout;
+
+
+typedef struct {
+	void *		report;
+	uint8		type;
+	uint8		id;
+	int32		itemCount;
+	int32		firstItem;
+} uis_report_layout;
+
+
+// UIS_LAYOUT_INFO fills the whole buffer passed to ioctl() with this header
+// followed by the uis_report_layout of all reports, ordered by type, and the
+// uis_item_layout of all their items. If the buffer is too small, the call
+// fails with B_BUFFER_OVERFLOW and size is set to the needed buffer size.
+typedef struct {
+	size_t		size;
+	uis_usage	usage;
+	int32		reportCount[UIS_REPORT_TYPES];
+	uint32		name;
+	int32		itemCount;
+	uint16		vendor;
+	uint16		product;
+		// USB ids of the device, 0 if there are none
+} uis_layout_info;
+
+
+// UIS_SET_FILTER and UIS_GET_FILTER access the noise filter the driver
+// applies to the absolute, non-binary items of a report, before deciding
+// whether a report changed. Both values are in the normalized -1..1 range
+// of the reported values: changes within deadzone of the center read as 0,
+// and a new value is only reported once it moved at least hysteresis away
+// from the last one. An index of -1 sets the filter of all report items.
+// At attach, the driver applies the "filter <report id> <item index>
+// <deadzone> <hysteresis>" entries of the "device <vendor id> <product id>"
+// section of the USB_HID_FILTER_SETTINGS driver settings, which the
+// input_server writes whenever a filter is set through it.
+#define USB_HID_FILTER_SETTINGS	"usb_hid_filters"
+
+typedef struct {
+	void *	report;
+	int32	index;
+	float	deadzone;
+	float	hysteresis;
+} uis_item_filter;
+
+
+// UIS_SET_IDLE and UIS_GET_IDLE access the HID idle rate of a report, how
+// often the device repeats it while nothing changes. A duration of 0 means
+// the report is only sent on changes. The device rounds it down to 4 ms
+// steps of at most 1020 ms. Report id 0 stands for all reports.
+typedef struct {
+	uint8		id;
+	bigtime_t	duration;
+} uis_idle_info;
+
+
+// UIS_SET_POLL_INTERVAL sets the minimum time between two transfers on the
+// interrupt endpoint, 0 polls as fast as the endpoint allows. Both it and
+// UIS_GET_POLL_INFO return the interval the endpoint is polled with, the one
+// its descriptor advertised, and the resulting effective interval, all in
+// microseconds. Polling faster than the endpoint advertises can only be set
+// up at attach time, with the poll_interval driver setting.
+typedef struct {
+	bigtime_t	interval;
+	bigtime_t	endpointInterval;
+	bigtime_t	advertisedInterval;
+	bigtime_t	effectiveInterval;
+} uis_poll_info;
+
+
+// UIS_READ_RAW waits for the next report like UIS_READ, but copies its
+// undecoded bytes, without the report id, to data instead of extracting the
+// items. length is the size of data on input and the report size on output.
+// Raw readers aren't buffered, a report that comes in while the reader is
+// busy is lost.
+typedef struct {
+	void *		report;
+	uint8		id;
+	bigtime_t	timestamp;
+	size_t		length;
+	uint8 *		data;
+} uis_raw_report;
+
+
+// UIS_DESCRIPTOR_INFO copies the raw HID report descriptor of the device to
+// data, as far as it fits, and sets length to the descriptor length. With
+// data being NULL only the length is returned.
+// UIS_DUMP_DESCRIPTOR takes no argument and writes the descriptor to
+// /tmp/usb_hid_report_descriptor_<vendor>_<product>_<interface>.bin for
+// troubleshooting.
+typedef struct {
+	size_t		length;
+	uint8 *		data;
+} uis_descriptor_info;
+
+
+// UIS_SET_INTEREST restricts the items UIS_READ extracts from a report to
+// those whose bit is set in mask, bit i % 8 of byte i / 8 standing for item
+// i, for the first count items. All other items aren't looked at. A NULL
+// mask makes all items interesting again, which is the default.
+typedef struct {
+	void *		report;
+	int32		count;
+	uint8 *		mask;
+} uis_interest_info;
+
+
+// UIS_GET_VALUE returns the value of an item in the last report that came
+// in, as UIS_READ would report it, without a request to the device. This is
+// for items UIS_SET_INTEREST left out until now, whose last value is stale.
+// Fails with B_NO_INIT if no report came in yet.
+typedef struct {
+	void *		report;
+	int32		index;
+	float		value;
+} uis_item_value;
+
+
+// counters of the USB interface, shared by all its devices
+typedef struct {
+	int32		transfers;
+	int32		transferErrors;
+	int32		stalls;
+	int32		shortReports;
+} uis_device_stats;
+
+
+typedef struct {
+	int32		wakeups;
+	int32		interruptedWakeups;
+	int32		reports;
+	int32		records;
+	int32		ringOverflows;
+	int32		missedReports;
+} uis_report_stats;
+
+
+// UIS_GET_STATS returns the device counters if report is NULL, and the
+// counters of report otherwise. With reset set, the returned counters restart
+// from 0. The device counters belong to the USB interface, interface tells
+// which one, and resetting them resets them for all its devices.
+typedef struct {
+	void *				report;
+	bool				reset;
+	void *				interface;
+	uis_device_stats	device;
+	uis_report_stats	reports;
+} uis_stats_info;
+
+
 #endif // _UIS_DRIVER_H
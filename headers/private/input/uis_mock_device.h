@@ -0,0 +1,52 @@
+#ifndef _UIS_MOCK_DEVICE_H
+#define _UIS_MOCK_DEVICE_H
+
+#include <SupportDefs.h>
+
+
+// Userland stand-in for UIS drivers: synthetic devices with a single input
+// report that implement the uis_driver.h ioctls. uis_mock_open() and
+// friends hand everything that isn't a mock device on to the real calls,
+// so they can replace open(), ioctl() and close() wholesale. Only needs
+// POSIX threads and system_time(), and builds for the host as well.
+
+enum {
+	UIS_MOCK_RAMP = 0,
+		// every item changes with every report
+	UIS_MOCK_RANDOM,
+		// every item changes with the given probability
+	UIS_MOCK_TOGGLE,
+		// button items, one of them toggles with every report
+};
+
+typedef struct {
+	int32	reportRate;
+		// reports per second, 0 for as fast as they are read
+	int32	itemCount;
+	int32	pattern;
+	float	changeProbability;
+		// for UIS_MOCK_RANDOM
+	bool	relative;
+	uint32	seed;
+} uis_mock_config;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+status_t	uis_mock_create(const uis_mock_config *config, char *path,
+				size_t pathLength);
+status_t	uis_mock_remove(const char *path);
+void		uis_mock_remove_all();
+
+int			uis_mock_open(const char *path, int mode);
+int			uis_mock_close(int fd);
+int			uis_mock_ioctl(int fd, uint32 op, void *buffer, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // _UIS_MOCK_DEVICE_H
@@ -13,10 +13,39 @@ enum {
 
 	B_UIS_GET_ITEM,
 	B_UIS_FIND_ITEM,
+	B_UIS_ITEM_POLL_VALUE,
 	B_UIS_ITEM_SET_TARGET,
+	B_UIS_ITEM_SET_FILTER,
+
+	B_UIS_GET_SERVER_PORT,
+
+	B_UIS_START_WATCHING,
+	B_UIS_STOP_WATCHING,
+
+	B_UIS_FIND_DEVICES,
+
+	B_UIS_GET_STATS,
+	B_UIS_GET_LATENCY,
+	B_UIS_EXPORT_TRACE,
+
+	B_UIS_START_RECORDING,
+	B_UIS_STOP_RECORDING,
+	B_UIS_START_REPLAY,
+		// with "wait", the reply only comes once the replay ended
+	B_UIS_STOP_REPLAY,
+
+	B_UIS_ADD_MOCK_DEVICES,
+	B_UIS_REMOVE_MOCK_DEVICES,
+
+	B_UIS_ITEM_GET_FILTER,
 };
 
 #define B_UIS_ITEM_EVENT '_UIE'
 
+// B_UIS_GET_LATENCY replies with histograms of B_UIS_LATENCY_BUCKETS
+// counts each. Bucket 0 counts latencies up to 1 us, bucket i > 0 those
+// from 2^i to 2^(i + 1) - 1 us, the last one everything above.
+#define B_UIS_LATENCY_BUCKETS 24
+
 
 #endif // _UIS_PROTOCOL_H
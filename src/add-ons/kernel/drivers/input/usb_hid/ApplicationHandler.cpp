@@ -3,12 +3,14 @@
 #include "Driver.h"
 #include "HIDDevice.h"
 #include "HIDReport.h"
+#include "HIDReportItem.h"
 #include "ReportHandler.h"
 
 #include <UTF8.h>
 
 #include <new>
 #include <stdlib.h>
+#include <string.h>
 
 
 #ifdef TRACE
@@ -172,11 +174,66 @@ ApplicationHandler::Control(uint32 op, void *buffer, size_t length)
 		case UIS_READ:
 		case UIS_SEND:
 		case UIS_STOP:
+		case UIS_SET_FILTER:
+		case UIS_GET_FILTER:
+		case UIS_READ_RAW:
+		case UIS_SET_INTEREST:
+		case UIS_GET_VALUE:
 			{
 				ReportHandler *handler = *((ReportHandler **) buffer);
 				return handler->Control(op, buffer, length);
 			}
 
+		case UIS_GET_STATS:
+			{
+				uis_stats_info *info = (uis_stats_info *) buffer;
+				info->interface = fDevice;
+				if (info->report == NULL)
+					fDevice->GetStats(&info->device, info->reset);
+				else {
+					((ReportHandler *) info->report)->GetStats(&info->reports,
+						info->reset);
+				}
+				return B_OK;
+			}
+
+		case UIS_LAYOUT_INFO:
+			return _GetLayout((uis_layout_info *) buffer, length);
+
+		case UIS_SET_IDLE:
+			{
+				uis_idle_info *info = (uis_idle_info *) buffer;
+				return fDevice->SetIdle(info->id, info->duration);
+			}
+
+		case UIS_GET_IDLE:
+			{
+				uis_idle_info *info = (uis_idle_info *) buffer;
+				return fDevice->GetIdle(info->id, &info->duration);
+			}
+
+		case UIS_SET_POLL_INTERVAL:
+			{
+				uis_poll_info *info = (uis_poll_info *) buffer;
+				fDevice->SetPollInterval(info->interval);
+				fDevice->GetPollInfo(info);
+				return B_OK;
+			}
+
+		case UIS_GET_POLL_INFO:
+			fDevice->GetPollInfo((uis_poll_info *) buffer);
+			return B_OK;
+
+		case UIS_DESCRIPTOR_INFO:
+			{
+				uis_descriptor_info *info = (uis_descriptor_info *) buffer;
+				return fDevice->GetReportDescriptor(info->data,
+					&info->length);
+			}
+
+		case UIS_DUMP_DESCRIPTOR:
+			return fDevice->DumpReportDescriptor();
+
 		case UIS_STRING_INFO:
 			{
 				uis_string_info *info = (uis_string_info *) buffer;
@@ -188,3 +245,88 @@ ApplicationHandler::Control(uint32 op, void *buffer, size_t length)
 
 	return B_DEV_INVALID_IOCTL;
 }
+
+
+/*!	Sets the filter of the items of the input report with the given id.
+	Returns B_BAD_INDEX if this application has no such report.
+*/
+status_t
+ApplicationHandler::SetFilter(uint8 reportId, int32 index, float deadzone,
+	float hysteresis)
+{
+	for (uint8 i = 0; i < fReportHandlerCount[UIS_REPORT_TYPE_INPUT]; i++) {
+		ReportHandler *handler = fReportHandlers[UIS_REPORT_TYPE_INPUT][i];
+		if (handler->Report()->ID() == reportId)
+			return handler->SetFilter(index, deadzone, hysteresis);
+	}
+	return B_BAD_INDEX;
+}
+
+
+status_t
+ApplicationHandler::_GetLayout(uis_layout_info *info, size_t length)
+{
+	if (info == NULL || length < sizeof(uis_layout_info))
+		return B_BAD_VALUE;
+
+	int32 reportCount = 0, itemCount = 0;
+	for (uint8 type = 0; type < UIS_REPORT_TYPES; type++) {
+		reportCount += fReportHandlerCount[type];
+		for (uint8 i = 0; i < fReportHandlerCount[type]; i++)
+			itemCount += fReportHandlers[type][i]->Report()->CountItems();
+	}
+
+	info->size = sizeof(uis_layout_info)
+		+ sizeof(uis_report_layout) * reportCount
+		+ sizeof(uis_item_layout) * itemCount;
+	info->usage.extended = fUsage;
+	for (uint8 type = 0; type < UIS_REPORT_TYPES; type++)
+		info->reportCount[type] = fReportHandlerCount[type];
+	info->name = fDevice->Name();
+	info->itemCount = itemCount;
+	info->vendor = fDevice->VendorId();
+	info->product = fDevice->ProductId();
+
+	if (length < info->size)
+		return B_BUFFER_OVERFLOW;
+
+	uis_report_layout *reportLayout = (uis_report_layout *) (info + 1);
+	uis_item_layout *itemLayout = (uis_item_layout *) (reportLayout
+		+ reportCount);
+	int32 firstItem = 0;
+
+	for (uint8 type = 0; type < UIS_REPORT_TYPES; type++) {
+		for (uint8 i = 0; i < fReportHandlerCount[type]; i++) {
+			ReportHandler *handler = fReportHandlers[type][i];
+			HIDReport *report = handler->Report();
+
+			reportLayout->report = handler;
+			reportLayout->type = type;
+			reportLayout->id = report->ID();
+			reportLayout->itemCount = report->CountItems();
+			reportLayout->firstItem = firstItem;
+			reportLayout++;
+
+			for (uint32 n = 0; n < report->CountItems(); n++) {
+				HIDReportItem *item = report->ItemAt(n);
+				if (item == NULL) {
+					memset(itemLayout++, 0, sizeof(uis_item_layout));
+					continue;
+				}
+
+				itemLayout->item = item;
+				itemLayout->usage.page = item->UsagePage();
+				itemLayout->usage.id = item->UsageID();
+				itemLayout->flags = (item->Relative() ? UIS_ITEM_RELATIVE : 0)
+					| (item->Array() ? UIS_ITEM_ARRAY : 0)
+					| (item->HasData() ? UIS_ITEM_HAS_DATA : 0);
+				itemLayout->minimum = (int32) item->Minimum();
+				itemLayout->maximum = (int32) item->Maximum();
+				itemLayout++;
+			}
+			firstItem += report->CountItems();
+		}
+	}
+
+	return B_OK;
+}
@@ -31,7 +31,12 @@ public:
 
 	status_t			Control(uint32 op, void *buffer, size_t length);
 
+	status_t			SetFilter(uint8 reportId, int32 index, float deadzone,
+							float hysteresis);
+
 private:
+	status_t			_GetLayout(uis_layout_info *info, size_t length);
+
 	HIDDevice *			fDevice;
 	uint32				fUsage;
 	char *				fPublishPath;
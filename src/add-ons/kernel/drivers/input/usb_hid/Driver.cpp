@@ -10,9 +10,11 @@
 #include "HIDReport.h"
 #include "ApplicationHandler.h"
 
+#include <ByteOrder.h>
 #include <lock.h>
 #include <new>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 
@@ -21,6 +23,302 @@ usb_module_info *gUSBModule = NULL;
 DeviceList *gDeviceList = NULL;
 static int32 sParentCookie = 0;
 static mutex sDriverLock;
+static void *sDriverSettings = NULL;
+
+static const uint16 kPortStatusHighSpeed = 0x0400;
+	// of the USB 2.0 hub port status
+
+typedef struct {
+	usb_endpoint_descriptor *	descriptor;
+		// NULL if the interval of the interface wasn't overridden
+	uint8						advertised;
+	uint8						interval;
+		// the pipe is set up with
+} endpoint_override;
+
+
+// #pragma mark - settings
+
+
+const driver_settings *
+usb_hid_settings()
+{
+	return get_driver_settings(sDriverSettings);
+}
+
+
+static const driver_parameter *
+find_device_settings(const driver_settings *settings, uint16 vendorId,
+	uint16 productId)
+{
+	if (settings == NULL)
+		return NULL;
+
+	for (int i = 0; i < settings->parameter_count; i++) {
+		const driver_parameter *parameter = &settings->parameters[i];
+		if (strcmp(parameter->name, "device") != 0
+			|| parameter->value_count < 2)
+			continue;
+
+		if (strtoul(parameter->values[0], NULL, 16) == vendorId
+			&& strtoul(parameter->values[1], NULL, 16) == productId)
+			return parameter;
+	}
+
+	return NULL;
+}
+
+
+/*!	Returns the "device <vendor id> <product id>" section of the driver
+	settings matching the device, ids being in hex, or NULL if there is none.
+*/
+const driver_parameter *
+usb_hid_device_settings(uint16 vendorId, uint16 productId)
+{
+	return find_device_settings(usb_hid_settings(), vendorId, productId);
+}
+
+
+/*!	Parses a decimal fraction like "0.05", as there's no strtod() in the
+	kernel.
+*/
+static float
+parse_fraction(const char *string)
+{
+	float value = 0.0f, scale = 1.0f;
+	bool fraction = false;
+	for (; *string != '\0'; string++) {
+		if (*string == '.' && !fraction) {
+			fraction = true;
+			continue;
+		}
+		if (*string < '0' || *string > '9')
+			break;
+		if (fraction) {
+			scale /= 10.0f;
+			value += (*string - '0') * scale;
+		} else
+			value = value * 10.0f + (*string - '0');
+	}
+	return value;
+}
+
+
+/*!	Applies the filters the input_server saved for the device, see
+	USB_HID_FILTER_SETTINGS. The settings are loaded on every attach, so
+	that filters set while the device was attached apply when it comes back.
+*/
+void
+usb_hid_apply_filters(uint16 vendorId, uint16 productId,
+	ApplicationHandler **handlers, uint32 handlerCount)
+{
+	void *handle = load_driver_settings(USB_HID_FILTER_SETTINGS);
+	if (handle == NULL)
+		return;
+
+	const driver_parameter *deviceSettings = find_device_settings(
+		get_driver_settings(handle), vendorId, productId);
+	for (int i = 0; deviceSettings != NULL
+			&& i < deviceSettings->parameter_count; i++) {
+		const driver_parameter *parameter = &deviceSettings->parameters[i];
+		if (strcmp(parameter->name, "filter") != 0
+			|| parameter->value_count < 4)
+			continue;
+
+		uint8 reportId = strtoul(parameter->values[0], NULL, 0);
+		int32 index = strtol(parameter->values[1], NULL, 0);
+		float deadzone = parse_fraction(parameter->values[2]);
+		float hysteresis = parse_fraction(parameter->values[3]);
+		for (uint32 n = 0; n < handlerCount; n++) {
+			if (handlers[n]->SetFilter(reportId, index, deadzone, hysteresis)
+					== B_OK)
+				break;
+		}
+	}
+
+	unload_driver_settings(handle);
+}
+
+
+/*!	Returns the "poll_interval <milliseconds>" of the device section, or 0
+	if the endpoint interval should be used.
+*/
+bigtime_t
+usb_hid_poll_interval(const driver_parameter *deviceSettings)
+{
+	if (deviceSettings == NULL)
+		return 0;
+
+	for (int i = 0; i < deviceSettings->parameter_count; i++) {
+		const driver_parameter *parameter = &deviceSettings->parameters[i];
+		if (strcmp(parameter->name, "poll_interval") == 0
+			&& parameter->value_count > 0)
+			return strtoul(parameter->values[0], NULL, 10) * 1000LL;
+	}
+
+	return 0;
+}
+
+
+// #pragma mark - endpoint intervals
+
+
+/*!	Returns whether the device runs at high or super speed, where the
+	endpoint intervals are exponents of 125 us microframes rather than
+	milliseconds. The USB module doesn't tell the speed, so it's taken from
+	the port status of the parent hub.
+*/
+bool
+usb_hid_is_high_speed(usb_device device)
+{
+	const usb_device_descriptor *descriptor
+		= gUSBModule->get_device_descriptor(device);
+	if (descriptor->usb_version < 0x0200)
+		return false;
+	if (descriptor->usb_version >= 0x0300)
+		return true;
+			// runs at super speed, or at high speed on a USB 2.0 port
+
+	usb_device hub;
+	uint8 port;
+	if (gUSBModule->get_device_parent(device, &hub, &port) != B_OK)
+		return false;
+
+	uint16 status[2];
+	size_t actualLength = 0;
+	if (gUSBModule->send_request(hub, USB_REQTYPE_CLASS | USB_REQTYPE_OTHER_IN,
+			USB_REQUEST_GET_STATUS, 0, port + 1, sizeof(status), status,
+			&actualLength) != B_OK || actualLength < sizeof(status)) {
+		TRACE_ALWAYS("cannot get the port status, assuming full speed\n");
+		return false;
+	}
+
+	return (B_LENDIAN_TO_HOST_INT16(status[0]) & kPortStatusHighSpeed) != 0;
+}
+
+
+/*!	Decodes the bInterval of an interrupt endpoint descriptor to
+	microseconds.
+*/
+bigtime_t
+usb_hid_endpoint_interval(uint8 interval, bool highSpeed)
+{
+	if (highSpeed)
+		return 125LL << (max_c(1, min_c(interval, 16)) - 1);
+	return max_c(1, interval) * 1000LL;
+}
+
+
+/*!	Encodes the interval to the largest bInterval not exceeding it.
+*/
+static uint8
+encode_endpoint_interval(bigtime_t interval, bool highSpeed)
+{
+	if (!highSpeed)
+		return max_c(1, min_c(interval / 1000, 255));
+
+	uint8 exponent = 1;
+	while (exponent < 16 && (125LL << exponent) <= interval)
+		exponent++;
+	return exponent;
+}
+
+
+/*!	The USB stack sets up the interrupt pipes with the interval of their
+	endpoint descriptor when the configuration is set, and has no call to
+	change it afterwards. To poll a device faster than it advertises, the
+	interval of the first interrupt in endpoint of each HID interface is
+	lowered for set_configuration() only: restore_endpoint_intervals() puts
+	the advertised one back right after it, so that the descriptors owned by
+	the USB module are left as they were. \a overrides has one entry per
+	interface, with the interval the pipe is set up with.
+*/
+static void
+override_endpoint_intervals(const usb_configuration_info *config,
+	bigtime_t pollInterval, bool highSpeed, endpoint_override *overrides)
+{
+	uint8 wanted = encode_endpoint_interval(pollInterval, highSpeed);
+
+	for (size_t i = 0; i < config->interface_count; i++) {
+		const usb_interface_info *interface = config->interface[i].active;
+		if (interface->descr->interface_class != USB_INTERFACE_CLASS_HID)
+			continue;
+
+		for (size_t n = 0; n < interface->endpoint_count; n++) {
+			usb_endpoint_descriptor *descriptor
+				= interface->endpoint[n].descr;
+			if ((descriptor->endpoint_address & USB_ENDPOINT_ADDR_DIR_IN) == 0
+				|| (descriptor->attributes & USB_ENDPOINT_ATTR_MASK)
+					!= USB_ENDPOINT_ATTR_INTERRUPT)
+				continue;
+
+			if (descriptor->interval > wanted) {
+				TRACE_ALWAYS("overriding endpoint interval %u with %u (%s)\n",
+					descriptor->interval, wanted,
+					highSpeed ? "microframe exponent" : "frames");
+				overrides[i].descriptor = descriptor;
+				overrides[i].advertised = descriptor->interval;
+				overrides[i].interval = wanted;
+				descriptor->interval = wanted;
+			}
+			break;
+		}
+	}
+}
+
+
+static void
+restore_endpoint_intervals(const endpoint_override *overrides, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (overrides[i].descriptor != NULL)
+			overrides[i].descriptor->interval = overrides[i].advertised;
+	}
+}
+
+
+// #pragma mark - debugger commands
+
+
+static int
+dump_report_descriptor(int argc, char **argv)
+{
+	if (argc > 2 || (argc == 2 && strcmp(argv[1], "--help") == 0)) {
+		kprintf("usage: %s [<device path>]\n"
+			"lists the devices, or dumps the report descriptor of one\n",
+			argv[0]);
+		return 0;
+	}
+
+	for (int32 i = 0; i < gDeviceList->CountDevices(); i++) {
+		ApplicationHandler *handler
+			= (ApplicationHandler *)gDeviceList->DeviceAt(i);
+		if (handler == NULL || handler->PublishPath() == NULL)
+			continue;
+
+		HIDDevice *device = handler->Device();
+		if (argc < 2) {
+			kprintf("%s: %lu bytes\n", handler->PublishPath(),
+				device->ReportDescriptorLength());
+			continue;
+		}
+
+		if (strcmp(argv[1], handler->PublishPath()) != 0)
+			continue;
+
+		const uint8 *descriptor = device->ReportDescriptor();
+		for (size_t n = 0; n < device->ReportDescriptorLength(); n++) {
+			kprintf("%02x%s", descriptor[n],
+				(n % 16 == 15 || n + 1 == device->ReportDescriptorLength())
+					? "\n" : " ");
+		}
+		return 0;
+	}
+
+	if (argc == 2)
+		kprintf("no device %s\n", argv[1]);
+	return 0;
+}
 
 
 // #pragma mark - notify hooks
@@ -47,10 +345,31 @@ usb_hid_device_added(usb_device device, void **cookie)
 		return B_ERROR;
 	}
 
+	// a poll_interval below the endpoint interval needs the pipes to be set
+	// up with a lower one, the speed is only asked for when it's needed
+	bigtime_t pollInterval = usb_hid_poll_interval(usb_hid_device_settings(
+		deviceDescriptor->vendor_id, deviceDescriptor->product_id));
+	int8 highSpeed = -1;
+	size_t interfaceCount = config->interface_count;
+	endpoint_override *overrides = NULL;
+	if (pollInterval != 0) {
+		overrides = (endpoint_override *)calloc(interfaceCount,
+			sizeof(endpoint_override));
+		if (overrides == NULL)
+			return B_NO_MEMORY;
+
+		highSpeed = usb_hid_is_high_speed(device) ? 1 : 0;
+		override_endpoint_intervals(config, pollInterval, highSpeed > 0,
+			overrides);
+	}
+
 	// ensure default configuration is set
 	status_t result = gUSBModule->set_configuration(device, config);
+	if (overrides != NULL)
+		restore_endpoint_intervals(overrides, interfaceCount);
 	if (result != B_OK) {
 		TRACE_ALWAYS("set_configuration() failed 0x%08lx\n", result);
+		free(overrides);
 		return result;
 	}
 
@@ -58,6 +377,7 @@ usb_hid_device_added(usb_device device, void **cookie)
 	config = gUSBModule->get_configuration(device);
 	if (config == NULL) {
 		TRACE_ALWAYS("cannot get current configuration\n");
+		free(overrides);
 		return B_ERROR;
 	}
 
@@ -72,8 +392,9 @@ usb_hid_device_added(usb_device device, void **cookie)
 
 		if (interfaceClass == USB_INTERFACE_CLASS_HID) {
 			mutex_lock(&sDriverLock);
-			HIDDevice *hidDevice
-				= new(std::nothrow) HIDDevice(device, config, i);
+			HIDDevice *hidDevice = new(std::nothrow) HIDDevice(device,
+				config, i, overrides != NULL && i < interfaceCount
+					? overrides[i].interval : 0, highSpeed);
 
 			if (hidDevice != NULL && hidDevice->InitCheck() == B_OK) {
 				hidDevice->SetParentCookie(parentCookie);
@@ -112,6 +433,7 @@ usb_hid_device_added(usb_device device, void **cookie)
 		}
 	}
 
+	free(overrides);
 	if (!devicesFound)
 		return B_ERROR;
 
@@ -273,6 +595,7 @@ init_driver()
 	}
 
 	mutex_init(&sDriverLock, "usb hid driver lock");
+	sDriverSettings = load_driver_settings(DRIVER_NAME);
 
 	static usb_notify_hooks notifyHooks = {
 		&usb_hid_device_added,
@@ -285,6 +608,8 @@ init_driver()
 
 	gUSBModule->register_driver(DRIVER_NAME, &supportDescriptor, 1, NULL);
 	gUSBModule->install_notify(DRIVER_NAME, &notifyHooks);
+	add_debugger_command("usb_hid_descriptor", &dump_report_descriptor,
+		"Dump the report descriptor of a USB HID device");
 	TRACE("init_driver() OK\n");
 	return B_OK;
 }
@@ -294,11 +619,14 @@ void
 uninit_driver()
 {
 	TRACE("uninit_driver()\n");
+	remove_debugger_command("usb_hid_descriptor", &dump_report_descriptor);
 	gUSBModule->uninstall_notify(DRIVER_NAME);
 	put_module(B_USB_MODULE_NAME);
 	delete gDeviceList;
 	gDeviceList = NULL;
 	mutex_destroy(&sDriverLock);
+	unload_driver_settings(sDriverSettings);
+	sDriverSettings = NULL;
 }
 
 
@@ -10,10 +10,13 @@
 #include <KernelExport.h>
 #include <OS.h>
 #include <USB3.h>
+#include <driver_settings.h>
 #include <util/kernel_cpp.h>
 
 #include "DeviceList.h"
 
+class ApplicationHandler;
+
 #define DRIVER_NAME	"usb_hid"
 
 #define USB_INTERFACE_CLASS_HID			3
@@ -24,6 +27,19 @@
 extern usb_module_info *gUSBModule;
 extern DeviceList *gDeviceList;
 
+const driver_settings *		usb_hid_settings();
+const driver_parameter *	usb_hid_device_settings(uint16 vendorId,
+								uint16 productId);
+bigtime_t					usb_hid_poll_interval(
+								const driver_parameter *deviceSettings);
+bool						usb_hid_is_high_speed(usb_device device);
+bigtime_t					usb_hid_endpoint_interval(uint8 interval,
+								bool highSpeed);
+void						usb_hid_apply_filters(uint16 vendorId,
+								uint16 productId,
+								ApplicationHandler **handlers,
+								uint32 handlerCount);
+
 extern "C" {
 status_t		usb_hid_device_added(usb_device device, void **cookie);
 status_t		usb_hid_device_removed(void *cookie);
@@ -34,6 +50,12 @@ const char **	publish_devices();
 device_hooks *	find_device(const char *name);
 }
 
+static inline int32
+read_counter(int32 *counter, bool reset)
+{
+	return reset ? atomic_set(counter, 0) : atomic_get(counter);
+}
+
 #define	TRACE(x...)			/*dprintf(DRIVER_NAME ": " x)*/
 #define TRACE_ALWAYS(x...)	dprintf(DRIVER_NAME ": " x)
 
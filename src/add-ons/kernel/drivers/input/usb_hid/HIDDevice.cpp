@@ -9,6 +9,7 @@
 
 #include <usb/USB_hid.h>
 
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -16,23 +17,68 @@
 #include <new>
 
 
+// the longest a string descriptor can be
+static const size_t kMaxStringDescriptorLength = 255;
+
+// the idle rate is given to the device in 4 ms units
+static const bigtime_t kIdleRateUnit = 4000;
+static const char *kIdleSetting = "idle_time";
+
+
+/*!	Looks for an "idle_time <milliseconds> [<report id>]" setting of the
+	report among the parameters, keeping value unchanged if there is none.
+*/
+static void
+find_idle_setting(const driver_parameter *parameters, int count,
+	uint8 reportID, const char **value)
+{
+	for (int i = 0; i < count; i++) {
+		const driver_parameter *parameter = &parameters[i];
+		if (strcmp(parameter->name, kIdleSetting) != 0
+			|| parameter->value_count < 1)
+			continue;
+
+		uint32 id = 0;
+		if (parameter->value_count > 1)
+			id = strtoul(parameter->values[1], NULL, 0);
+		if (id == reportID)
+			*value = parameter->values[0];
+	}
+}
+
+
 HIDDevice::HIDDevice(usb_device device, const usb_configuration_info *config,
-	size_t interfaceIndex)
+	size_t interfaceIndex, uint8 pipeInterval, int8 highSpeed)
 	:	fStatus(B_NO_INIT),
 		fDevice(device),
 		fInterfaceIndex(interfaceIndex),
 		fTransferScheduled(0),
 		fTransferBufferSize(0),
 		fTransferBuffer(NULL),
+		fPipeInterval(pipeInterval),
+		fAdvertisedInterval(0),
+		fHighSpeed(highSpeed),
+		fPollInterval(0),
+		fLastTransfer(0),
 		fParentCookie(-1),
 		fOpenCount(0),
 		fRemoved(false),
 		fParser(this),
+		fReportDescriptor(NULL),
+		fReportDescriptorLength(0),
 		fApplicationHandlerCount(0),
 		fApplicationHandlers(NULL),
 		fLangId(0),
-		fName(0)
+		fStringCache(NULL),
+		fStringCacheCount(0),
+		fSetupThread(-1),
+		fName(0),
+		fVendorId(0),
+		fProductId(0)
 {
+	mutex_init(&fStringLock, "usb hid string cache");
+	memset(&fStats, 0, sizeof(fStats));
+
 	// read HID descriptor
 	size_t descriptorLength = sizeof(usb_hid_descriptor);
 	usb_hid_descriptor *hidDescriptor
@@ -81,21 +127,15 @@ HIDDevice::HIDDevice(usb_device device, const usb_configuration_info *config,
 	const usb_device_descriptor *deviceDescriptor
 		= gUSBModule->get_device_descriptor(device);
 	fName = deviceDescriptor->product;
-#if 1
-	// save report descriptor for troubleshooting
-	char outputFile[128];
-	sprintf(outputFile, "/tmp/usb_hid_report_descriptor_%04x_%04x_%lu.bin",
-		deviceDescriptor->vendor_id, deviceDescriptor->product_id,
-		interfaceIndex);
-	int fd = open(outputFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-	if (fd >= 0) {
-		write(fd, reportDescriptor, descriptorLength);
-		close(fd);
-	}
-#endif
+	fVendorId = deviceDescriptor->vendor_id;
+	fProductId = deviceDescriptor->product_id;
+
+	// keep the descriptor around for clients doing their own parsing and for
+	// troubleshooting, see DumpReportDescriptor()
+	fReportDescriptor = reportDescriptor;
+	fReportDescriptorLength = descriptorLength;
 
 	result = fParser.ParseReportDescriptor(reportDescriptor, descriptorLength);
-	free(reportDescriptor);
 	if (result != B_OK) {
 		TRACE_ALWAYS("parsing the report descriptor failed\n");
 		fStatus = result;
@@ -107,7 +147,9 @@ HIDDevice::HIDDevice(usb_device device, const usb_configuration_info *config,
 		fParser.ReportAt(HID_REPORT_TYPE_ANY, i)->PrintToStream();
 #endif
 
-	// find the interrupt in pipe
+	// find the interrupt in pipe, it was set up with the interval of its
+	// descriptor, unless the poll_interval setting lowered it, see
+	// override_endpoint_intervals()
 	usb_interface_info *interface = config->interface[interfaceIndex].active;
 	for (size_t i = 0; i < interface->endpoint_count; i++) {
 		usb_endpoint_descriptor *descriptor = interface->endpoint[i].descr;
@@ -115,6 +157,9 @@ HIDDevice::HIDDevice(usb_device device, const usb_configuration_info *config,
 			&& (descriptor->attributes & USB_ENDPOINT_ATTR_MASK)
 				== USB_ENDPOINT_ATTR_INTERRUPT) {
 			fInterruptPipe = interface->endpoint[i].handle;
+			fAdvertisedInterval = descriptor->interval;
+			if (fPipeInterval == 0)
+				fPipeInterval = descriptor->interval;
 			break;
 		}
 	}
@@ -137,19 +182,40 @@ HIDDevice::HIDDevice(usb_device device, const usb_configuration_info *config,
 		return;
 	}
 
+	fPollInterval = usb_hid_poll_interval(usb_hid_device_settings(
+		deviceDescriptor->vendor_id, deviceDescriptor->product_id));
+
 	ApplicationHandler::AddHandlers(this, &fApplicationHandlers,
 		&fApplicationHandlerCount);
+	usb_hid_apply_filters(fVendorId, fProductId, fApplicationHandlers,
+		fApplicationHandlerCount);
 	fStatus = B_OK;
+
+	// the idle rates and strings take several control transfers, so they
+	// are set up outside of the attach path
+	fSetupThread = spawn_kernel_thread(_DeferredSetupThread,
+		"usb hid deferred setup", B_LOW_PRIORITY, this);
+	if (fSetupThread >= B_OK)
+		resume_thread(fSetupThread);
 }
 
 
 HIDDevice::~HIDDevice()
 {
+	if (fSetupThread >= B_OK)
+		wait_for_thread(fSetupThread, NULL);
+
+	for (uint32 i = 0; i < fStringCacheCount; i++)
+		free(fStringCache[i].data);
+	free(fStringCache);
+	mutex_destroy(&fStringLock);
+
 	for (uint32 i = 0; i < fApplicationHandlerCount; i++)
 		delete fApplicationHandlers[i];
 
 	free(fApplicationHandlers);
 	free(fTransferBuffer);
+	free(fReportDescriptor);
 }
 
 
@@ -195,6 +261,17 @@ HIDDevice::MaybeScheduleTransfer()
 		return B_OK;
 	}
 
+	// slow the polling down to the configured interval, this runs in the
+	// context of the reader that asked for the next report
+	bigtime_t wait = fLastTransfer + fPollInterval - system_time();
+	if (wait > 0) {
+		snooze(wait);
+		if (fRemoved) {
+			atomic_set(&fTransferScheduled, 0);
+			return B_ERROR;
+		}
+	}
+
 	TRACE("scheduling interrupt transfer of %lu bytes\n", fTransferBufferSize);
 	status_t result = gUSBModule->queue_interrupt(fInterruptPipe,
 		fTransferBuffer, fTransferBufferSize, _TransferCallback, this);
@@ -218,6 +295,72 @@ HIDDevice::SendReport(HIDReport *report)
 }
 
 
+status_t
+HIDDevice::SetIdle(uint8 reportID, bigtime_t duration)
+{
+	uint32 rate = min_c(duration / kIdleRateUnit, 255);
+	size_t actualLength;
+	return gUSBModule->send_request(fDevice,
+		USB_REQTYPE_INTERFACE_OUT | USB_REQTYPE_CLASS,
+		USB_REQUEST_HID_SET_IDLE, rate << 8 | reportID, fInterfaceIndex,
+		0, NULL, &actualLength);
+}
+
+
+status_t
+HIDDevice::GetIdle(uint8 reportID, bigtime_t *duration)
+{
+	uint8 rate;
+	size_t actualLength;
+	status_t result = gUSBModule->send_request(fDevice,
+		USB_REQTYPE_INTERFACE_IN | USB_REQTYPE_CLASS,
+		USB_REQUEST_HID_GET_IDLE, reportID, fInterfaceIndex, 1, &rate,
+		&actualLength);
+	if (result != B_OK)
+		return result;
+	if (actualLength != 1)
+		return B_ERROR;
+
+	*duration = rate * kIdleRateUnit;
+	return B_OK;
+}
+
+
+void
+HIDDevice::SetPollInterval(bigtime_t interval)
+{
+	fPollInterval = max_c(interval, 0);
+}
+
+
+/*!	The speed is only found out here if the attach didn't need it, as it
+	takes a request to the parent hub.
+*/
+void
+HIDDevice::GetPollInfo(uis_poll_info *info)
+{
+	if (fHighSpeed < 0)
+		fHighSpeed = usb_hid_is_high_speed(fDevice) ? 1 : 0;
+
+	info->interval = fPollInterval;
+	info->endpointInterval = usb_hid_endpoint_interval(fPipeInterval,
+		fHighSpeed > 0);
+	info->advertisedInterval = usb_hid_endpoint_interval(fAdvertisedInterval,
+		fHighSpeed > 0);
+	info->effectiveInterval = max_c(fPollInterval, info->endpointInterval);
+}
+
+
+void
+HIDDevice::GetStats(uis_device_stats *stats, bool reset)
+{
+	stats->transfers = read_counter(&fStats.transfers, reset);
+	stats->transferErrors = read_counter(&fStats.transferErrors, reset);
+	stats->stalls = read_counter(&fStats.stalls, reset);
+	stats->shortReports = read_counter(&fStats.shortReports, reset);
+}
+
+
 ApplicationHandler *
 HIDDevice::ApplicationHandlerAt(uint32 index)
 {
@@ -232,12 +375,19 @@ HIDDevice::_TransferCallback(void *cookie, status_t status, void *data,
 	size_t actualLength)
 {
 	HIDDevice *device = (HIDDevice *)cookie;
+	atomic_add(&device->fStats.transfers, 1);
+	if (status != B_OK)
+		atomic_add(&device->fStats.transferErrors, 1);
+	if (status == B_DEV_STALLED)
+		atomic_add(&device->fStats.stalls, 1);
+
 	if (status == B_DEV_STALLED && !device->fRemoved) {
 		// try clearing stalls right away, the report listeners will resubmit
 		gUSBModule->clear_feature(device->fInterruptPipe,
 			USB_FEATURE_ENDPOINT_HALT);
 	}
 
+	device->fLastTransfer = system_time();
 	atomic_set(&device->fTransferScheduled, 0);
 	device->fParser.SetReport(status, device->fTransferBuffer, actualLength);
 }
@@ -245,6 +395,214 @@ HIDDevice::_TransferCallback(void *cookie, status_t status, void *data,
 
 status_t
 HIDDevice::GetString(uint8 index, char *string, int32 *length)
+{
+	mutex_lock(&fStringLock);
+
+	string_cache_entry *entry;
+	status_t status = _CachedString(index, &entry);
+	if (status == B_OK)
+		status = entry->status;
+	if (status == B_OK) {
+		if (string == NULL)
+			*length = entry->length;
+		else {
+			*length = min_c(*length, entry->length);
+			status = user_memcpy(string, entry->data, *length);
+		}
+	}
+
+	mutex_unlock(&fStringLock);
+	return status;
+}
+
+
+status_t
+HIDDevice::GetReportDescriptor(uint8 *data, size_t *length)
+{
+	status_t status = B_OK;
+	if (data != NULL) {
+		status = user_memcpy(data, fReportDescriptor,
+			min_c(*length, fReportDescriptorLength));
+	}
+
+	*length = fReportDescriptorLength;
+	return status;
+}
+
+
+/*!	Writes the report descriptor to /tmp for troubleshooting. This used to
+	happen for every interface at attach time, now it has to be asked for.
+*/
+status_t
+HIDDevice::DumpReportDescriptor()
+{
+	const usb_device_descriptor *deviceDescriptor
+		= gUSBModule->get_device_descriptor(fDevice);
+	if (deviceDescriptor == NULL)
+		return B_ERROR;
+
+	char outputFile[128];
+	sprintf(outputFile, "/tmp/usb_hid_report_descriptor_%04x_%04x_%lu.bin",
+		deviceDescriptor->vendor_id, deviceDescriptor->product_id,
+		fInterfaceIndex);
+	int fd = open(outputFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return errno;
+
+	ssize_t written = write(fd, fReportDescriptor, fReportDescriptorLength);
+	close(fd);
+	if (written < 0)
+		return errno;
+	return (size_t) written == fReportDescriptorLength ? B_OK : B_IO_ERROR;
+}
+
+
+/*!	Sets the idle rates the driver settings ask for, an idle rate of 0 makes
+	the device send its input reports only when they change. Devices without
+	a setting keep their default, so that nothing is sent to them. Settings in
+	the device section override the global ones, and "idle_time off" leaves
+	the device default alone. Devices are free to refuse the request, so
+	failures only get traced.
+*/
+void
+HIDDevice::_InitIdleRates(const usb_device_descriptor *descriptor)
+{
+	const driver_settings *settings = usb_hid_settings();
+	const driver_parameter *device = usb_hid_device_settings(
+		descriptor->vendor_id, descriptor->product_id);
+	if (settings == NULL && device == NULL)
+		return;
+
+	// report id 0 sets all reports, so it has to come first
+	for (int32 i = -1;
+			i < (int32) fParser.CountReports(HID_REPORT_TYPE_INPUT); i++) {
+		if (fRemoved)
+			break;
+
+		uint8 reportID = 0;
+		const char *value = NULL;
+		if (i >= 0) {
+			reportID = fParser.ReportAt(HID_REPORT_TYPE_INPUT, i)->ID();
+			if (reportID == 0)
+				continue;
+		}
+
+		if (settings != NULL) {
+			find_idle_setting(settings->parameters, settings->parameter_count,
+				reportID, &value);
+		}
+		if (device != NULL) {
+			find_idle_setting(device->parameters, device->parameter_count,
+				reportID, &value);
+		}
+		if (value == NULL || strcmp(value, "off") == 0)
+			continue;
+
+		status_t result = SetIdle(reportID,
+			strtoul(value, NULL, 10) * 1000LL);
+		TRACE("set idle of report %u to %s ms: 0x%08lx\n", reportID, value,
+			result);
+		if (result != B_OK && reportID == 0)
+			break;
+			// the device doesn't support it
+	}
+}
+
+
+/*!	Sets the idle rates, and fetches the strings that are needed as soon as
+	someone opens the device.
+*/
+status_t
+HIDDevice::_DeferredSetupThread(void *cookie)
+{
+	HIDDevice *device = (HIDDevice *)cookie;
+	const usb_device_descriptor *descriptor
+		= gUSBModule->get_device_descriptor(device->fDevice);
+	if (descriptor == NULL)
+		return B_ERROR;
+
+	device->_InitIdleRates(descriptor);
+
+	uint8 indices[] = { descriptor->product, descriptor->manufacturer,
+		descriptor->serial_number };
+	for (uint32 i = 0; i < sizeof(indices) / sizeof(indices[0]); i++) {
+		if (device->fRemoved)
+			break;
+		if (indices[i] == 0)
+			continue;
+
+		string_cache_entry *entry;
+		mutex_lock(&device->fStringLock);
+		device->_CachedString(indices[i], &entry);
+		mutex_unlock(&device->fStringLock);
+	}
+
+	return B_OK;
+}
+
+
+/*!	Returns the cache entry of the string, fetching it from the device if it
+	isn't cached yet. Strings and B_BAD_INDEX are cached, so that unset
+	strings don't cost a control transfer on every request, while other
+	failures are retried the next time. fStringLock must be held, it's
+	released during the transfers.
+*/
+status_t
+HIDDevice::_CachedString(uint8 index, string_cache_entry **_entry)
+{
+	*_entry = _FindCachedString(index);
+	if (*_entry != NULL)
+		return B_OK;
+
+	string_cache_entry fetched;
+	fetched.index = index;
+	fetched.length = 0;
+	fetched.data = NULL;
+	if (index == 0)
+		fetched.status = B_BAD_INDEX;
+	else {
+		mutex_unlock(&fStringLock);
+		fetched.status = _FetchString(&fetched);
+		mutex_lock(&fStringLock);
+
+		// someone else may have fetched it meanwhile
+		*_entry = _FindCachedString(index);
+		if (*_entry != NULL) {
+			free(fetched.data);
+			return B_OK;
+		}
+	}
+
+	if (fetched.status != B_OK && fetched.status != B_BAD_INDEX)
+		return fetched.status;
+
+	string_cache_entry *cache = (string_cache_entry *)realloc(fStringCache,
+		sizeof(string_cache_entry) * (fStringCacheCount + 1));
+	if (cache == NULL) {
+		free(fetched.data);
+		return B_NO_MEMORY;
+	}
+	fStringCache = cache;
+
+	*_entry = &fStringCache[fStringCacheCount++];
+	**_entry = fetched;
+	return B_OK;
+}
+
+
+string_cache_entry *
+HIDDevice::_FindCachedString(uint8 index)
+{
+	for (uint32 i = 0; i < fStringCacheCount; i++) {
+		if (fStringCache[i].index == index)
+			return &fStringCache[i];
+	}
+	return NULL;
+}
+
+
+status_t
+HIDDevice::_FetchString(string_cache_entry *entry)
 {
 	size_t actualLength;
 	status_t status;
@@ -262,49 +620,39 @@ HIDDevice::GetString(uint8 index, char *string, int32 *length)
 		//TRACE("will use language: %04x\n", fLangId);
 	}
 
-
-	if (string == NULL) {
-		uint8 header[2];
-
-		status = gUSBModule->get_descriptor(fDevice, USB_DESCRIPTOR_STRING,
-			index, fLangId, header, 2, &actualLength);
-		//TRACE("getstring status: %08x, actual length: %d, data: %x\n",
-		//	status, actualLength, header[0]);
-		if (status != B_OK)
-			return status;
-		if (actualLength != 2 || header[1] != USB_DESCRIPTOR_STRING)
-			return B_ERROR;
-		*length = header[0] - 2;
-		return B_OK;
-	}
-
-	size_t requestedLength = *length + 2;
-	uint8 *data = (uint8 *) malloc(requestedLength);
+	// ask for the longest possible descriptor, so that the string comes in
+	// with a single transfer instead of a header and a content request
+	uint8 *data = (uint8 *) malloc(kMaxStringDescriptorLength);
 	if (data == NULL)
-		return B_ERROR;
+		return B_NO_MEMORY;
 
-	//TRACE("asking for string at index: %d\n", index);
-	status = gUSBModule->get_descriptor(fDevice, USB_DESCRIPTOR_STRING, index,
-		fLangId, data, requestedLength, &actualLength);
+	//TRACE("asking for string at index: %d\n", entry->index);
+	status = gUSBModule->get_descriptor(fDevice, USB_DESCRIPTOR_STRING,
+		entry->index, fLangId, data, kMaxStringDescriptorLength,
+		&actualLength);
 	//TRACE("getstring status: %08x, actual length: %d\n", status, actualLength);
 	if (status != B_OK) {
 		free(data);
 		return status;
 	}
-	if (actualLength != requestedLength	|| data[1] != USB_DESCRIPTOR_STRING) {
+	if (actualLength < 2 || data[1] != USB_DESCRIPTOR_STRING
+		|| data[0] > actualLength) {
 		free(data);
 		return B_ERROR;
 	}
+	actualLength = data[0];
 
 	// temporary hack to swap endianness, from UTF-16LE to UTF16-BE
 	// until Haiku get UTF-16LE supported in convert_to_utf8
-	for (uint8 n = 2; n < actualLength; n += 2) {
+	for (uint8 n = 2; n + 1 < actualLength; n += 2) {
 		uint8 tmp = data[n];
 		data[n] = data[n+1];
 		data[n+1] = tmp;
 	}
-	user_memcpy(string, data + 2, *length);
-	free(data);
+
+	entry->length = actualLength - 2;
+	memmove(data, data + 2, entry->length);
+	entry->data = data;
 
 	return B_OK;
 }
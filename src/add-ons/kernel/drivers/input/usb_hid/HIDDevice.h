@@ -7,16 +7,26 @@
 #define USB_HID_DEVICE_H
 
 #include "HIDParser.h"
+#include "uis_driver.h"
 
 #include <USB3.h>
+#include <lock.h>
 
 class ApplicationHandler;
 
+struct string_cache_entry {
+	uint8					index;
+	status_t				status;
+	int32					length;
+	uint8 *					data;
+};
+
 class HIDDevice {
 public:
 								HIDDevice(usb_device device,
 									const usb_configuration_info *config,
-									size_t interfaceIndex);
+									size_t interfaceIndex,
+									uint8 pipeInterval, int8 highSpeed);
 								~HIDDevice();
 
 		void					SetParentCookie(int32 cookie);
@@ -35,6 +45,15 @@ public:
 
 		status_t				SendReport(HIDReport *report);
 
+		status_t				SetIdle(uint8 reportID, bigtime_t duration);
+		status_t				GetIdle(uint8 reportID, bigtime_t *duration);
+
+		void					SetPollInterval(bigtime_t interval);
+		void					GetPollInfo(uis_poll_info *info);
+
+		uis_device_stats *		Stats() { return &fStats; };
+		void					GetStats(uis_device_stats *stats, bool reset);
+
 		HIDParser *				Parser() { return &fParser; };
 		ApplicationHandler *	ApplicationHandlerAt(uint32 index);
 
@@ -45,12 +64,33 @@ public:
 									int32 *length);
 
 		uint8					Name() { return fName; };
+		uint16					VendorId() { return fVendorId; };
+		uint16					ProductId() { return fProductId; };
+
+		status_t				GetReportDescriptor(uint8 *data,
+									size_t *length);
+		status_t				DumpReportDescriptor();
+
+		// only to be used for the kernel debugger information
+		const uint8 *			ReportDescriptor()
+									{ return fReportDescriptor; };
+		size_t					ReportDescriptorLength()
+									{ return fReportDescriptorLength; };
 
 private:
 static	void					_TransferCallback(void *cookie,
 									status_t status, void *data,
 									size_t actualLength);
 
+		void					_InitIdleRates(
+									const usb_device_descriptor *descriptor);
+
+static	status_t				_DeferredSetupThread(void *cookie);
+		status_t				_CachedString(uint8 index,
+									string_cache_entry **_entry);
+		string_cache_entry *	_FindCachedString(uint8 index);
+		status_t				_FetchString(string_cache_entry *entry);
+
 		status_t				fStatus;
 		usb_device				fDevice;
 		usb_pipe				fInterruptPipe;
@@ -60,18 +100,36 @@ static	void					_TransferCallback(void *cookie,
 		size_t					fTransferBufferSize;
 		uint8 *					fTransferBuffer;
 
+		uint8					fPipeInterval;
+		uint8					fAdvertisedInterval;
+									// both as bInterval
+		int8					fHighSpeed;
+									// -1 until it's needed
+		bigtime_t				fPollInterval;
+		bigtime_t				fLastTransfer;
+
+		uis_device_stats		fStats;
+
 		int32					fParentCookie;
 		int32					fOpenCount;
 		bool					fRemoved;
 
 		HIDParser				fParser;
+		uint8 *					fReportDescriptor;
+		size_t					fReportDescriptorLength;
 
 		uint32					fApplicationHandlerCount;
 		ApplicationHandler **	fApplicationHandlers;
 
 		uint16					fLangId;
+		mutex					fStringLock;
+		string_cache_entry *	fStringCache;
+		uint32					fStringCacheCount;
+		thread_id				fSetupThread;
 
 		uint8					fName;
+		uint16					fVendorId;
+		uint16					fProductId;
 };
 
 #endif // USB_HID_DEVICE_H
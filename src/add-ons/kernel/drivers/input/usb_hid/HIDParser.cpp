@@ -3,7 +3,7 @@
  * Distributed under the terms of the MIT License.
  */
 
-#include "Driver.h"
+#include "HIDPlatform.h"
 #include "HIDParser.h"
 #include "HIDReport.h"
 
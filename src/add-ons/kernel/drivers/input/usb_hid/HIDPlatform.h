@@ -0,0 +1,20 @@
+#ifndef HID_PLATFORM_H
+#define HID_PLATFORM_H
+
+// The parser (HIDParser, HIDReport and HIDReportItem) is shared between the
+// driver and a userland build for the host, see host/Jamfile. It includes
+// this instead of Driver.h, and leaves out everything that needs a device
+// when _KERNEL_MODE isn't defined.
+
+#ifdef _KERNEL_MODE
+#	include "Driver.h"
+#else
+#	include <OS.h>
+
+#	include <stdio.h>
+
+#	define TRACE(x...)			/*fprintf(stderr, "usb_hid: " x)*/
+#	define TRACE_ALWAYS(x...)	fprintf(stderr, "usb_hid: " x)
+#endif
+
+#endif // HID_PLATFORM_H
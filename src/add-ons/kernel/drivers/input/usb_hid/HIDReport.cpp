@@ -3,8 +3,10 @@
  * Distributed under the terms of the MIT License.
  */
 
-#include "Driver.h"
+#include "HIDPlatform.h"
+#ifdef _KERNEL_MODE
 #include "HIDDevice.h"
+#endif
 #include "HIDReport.h"
 #include "HIDReportItem.h"
 
@@ -28,14 +30,23 @@ HIDReport::HIDReport(HIDParser *parser, uint8 type, uint8 id,
 	fItems(NULL),
 	fReportStatus(B_NO_INIT),
 	fCurrentReport(NULL),
-	fBusyCount(0)
+	fReportTime(0),
+	fBusyCount(0),
+	fWaiterCount(0),
+	fMissedReportHook(NULL),
+	fMissedReportCookie(NULL)
 {
+#ifdef _KERNEL_MODE
 	fConditionVariable.Init(this, "hid report");
+#endif
 }
 
 
 HIDReport::~HIDReport()
 {
+	for (uint32 i = 0; i < fItemsUsed; i++)
+		delete fItems[i];
+
 	free(fItems);
 }
 
@@ -162,16 +173,29 @@ HIDReport::SetReport(status_t status, uint8 *report, size_t length)
 {
 	fReportStatus = status;
 	fCurrentReport = report;
+	fReportTime = system_time();
 	if (status == B_OK && length * 8 < fReportSize) {
-		TRACE_ALWAYS("report of %lu bits too small, expected %lu bits\n",
-			length * 8, fReportSize);
+		TRACE_ALWAYS("report of %" B_PRIuSIZE " bits too small, expected %"
+			B_PRIu32 " bits\n", length * 8, fReportSize);
 		fReportStatus = B_ERROR;
+#ifdef _KERNEL_MODE
+		atomic_add(&Device()->Stats()->shortReports, 1);
+#endif
 	}
 
+	// Waiters are counted before they start waiting, so a report passed to
+	// the hook can't also reach a reader.
+	if (fReportStatus == B_OK && fMissedReportHook != NULL
+		&& atomic_get(&fWaiterCount) == 0)
+		fMissedReportHook(this, fMissedReportCookie);
+
+#ifdef _KERNEL_MODE
 	fConditionVariable.NotifyAll();
+#endif
 }
 
 
+#ifdef _KERNEL_MODE
 status_t
 HIDReport::SendReport()
 {
@@ -197,6 +221,7 @@ HIDReport::SendReport()
 	free(report);
 	return result;
 }
+#endif
 
 
 HIDReportItem *
@@ -221,22 +246,26 @@ HIDReport::FindItem(uint16 usagePage, uint16 usageID)
 }
 
 
+#ifdef _KERNEL_MODE
 status_t
 HIDReport::WaitForReport(bigtime_t timeout)
 {
 	while (atomic_get(&fBusyCount) != 0)
 		snooze(1000);
 
+	atomic_add(&fWaiterCount, 1);
 	ConditionVariableEntry conditionVariableEntry;
 	fConditionVariable.Add(&conditionVariableEntry);
 	status_t result = fParser->Device()->MaybeScheduleTransfer();
 	if (result != B_OK) {
 		TRACE_ALWAYS("scheduling transfer failed\n");
 		conditionVariableEntry.Wait(B_RELATIVE_TIMEOUT, 0);
+		atomic_add(&fWaiterCount, -1);
 		return result;
 	}
 
 	result = conditionVariableEntry.Wait(B_RELATIVE_TIMEOUT, timeout);
+	atomic_add(&fWaiterCount, -1);
 	TRACE("waiting for report returned with result: %s\n", strerror(result));
 	if (result != B_OK)
 		return result;
@@ -254,6 +283,19 @@ HIDReport::DoneProcessing()
 {
 	atomic_add(&fBusyCount, -1);
 }
+#endif
+
+
+/*!	Sets a hook that is called with the reports that come in while nobody
+	waits for them, instead of letting them go by unseen. It is called from
+	the transfer callback and must not block for long.
+*/
+void
+HIDReport::SetMissedReportHook(missed_report_hook hook, void *cookie)
+{
+	fMissedReportCookie = cookie;
+	fMissedReportHook = hook;
+}
 
 
 void
@@ -276,10 +318,10 @@ HIDReport::PrintToStream()
 
 	TRACE_ALWAYS("\ttype: %u %s\n", fType, typeName);
 	TRACE_ALWAYS("\treport id: %u\n", fReportID);
-	TRACE_ALWAYS("\treport size: %lu bits = %lu bytes\n", fReportSize,
-		(fReportSize + 7) / 8);
+	TRACE_ALWAYS("\treport size: %" B_PRIu32 " bits = %" B_PRIu32 " bytes\n",
+		fReportSize, (fReportSize + 7) / 8);
 
-	TRACE_ALWAYS("\titem count: %lu\n", fItemsUsed);
+	TRACE_ALWAYS("\titem count: %" B_PRIu32 "\n", fItemsUsed);
 	for (uint32 i = 0; i < fItemsUsed; i++) {
 		HIDReportItem *item = fItems[i];
 		if (item != NULL)
@@ -7,7 +7,9 @@
 
 #include "HIDParser.h"
 
+#ifdef _KERNEL_MODE
 #include <condition_variable.h>
+#endif
 
 #define HID_REPORT_TYPE_INPUT		0x01
 #define HID_REPORT_TYPE_OUTPUT		0x02
@@ -15,8 +17,11 @@
 #define HID_REPORT_TYPE_ANY			0x07
 
 class HIDCollection;
+class HIDReport;
 class HIDReportItem;
 
+typedef void (*missed_report_hook)(HIDReport *report, void *cookie);
+
 class HIDReport {
 public:
 								HIDReport(HIDParser *parser, uint8 type,
@@ -40,15 +45,23 @@ public:
 		void					SetReport(status_t status, uint8 *report,
 									size_t length);
 		uint8 *					CurrentReport() { return fCurrentReport; };
+		bigtime_t				ReportTime() { return fReportTime; };
 
+#ifdef _KERNEL_MODE
 		status_t				SendReport();
+#endif
 
 		uint32					CountItems() { return fItemsUsed; };
 		HIDReportItem *			ItemAt(uint32 index);
 		HIDReportItem *			FindItem(uint16 usagePage, uint16 usageID);
 
+#ifdef _KERNEL_MODE
 		status_t				WaitForReport(bigtime_t timeout);
 		void					DoneProcessing();
+#endif
+
+		void					SetMissedReportHook(missed_report_hook hook,
+									void *cookie);
 
 		void					PrintToStream();
 
@@ -68,8 +81,15 @@ private:
 
 		status_t				fReportStatus;
 		uint8 *					fCurrentReport;
+		bigtime_t				fReportTime;
 		int32					fBusyCount;
+		int32					fWaiterCount;
+#ifdef _KERNEL_MODE
 		ConditionVariable		fConditionVariable;
+#endif
+
+		missed_report_hook		fMissedReportHook;
+		void *					fMissedReportCookie;
 };
 
 #endif // HID_REPORT_H
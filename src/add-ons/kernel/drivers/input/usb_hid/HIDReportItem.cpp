@@ -3,7 +3,7 @@
  * Distributed under the terms of the MIT License.
  */
 
-#include "Driver.h"
+#include "HIDPlatform.h"
 
 #include "HIDReportItem.h"
 #include "HIDReport.h"
@@ -61,21 +61,35 @@ HIDReportItem::Extract()
 	if (report == NULL)
 		return B_NO_INIT;
 
-	memcpy(&fData, report + fByteOffset, sizeof(uint32));
-	fData >>= fShift;
-	fData &= fMask;
+	fValid = ExtractFrom(report, &fData) == B_OK;
+	return B_OK;
+}
+
+
+/*!	Extracts the item from the given report data without touching the
+	state of the item. Returns B_BAD_VALUE if the data is out of range.
+*/
+status_t
+HIDReportItem::ExtractFrom(const uint8 *report, uint32 *_data)
+{
+	uint32 data;
+	memcpy(&data, report + fByteOffset, sizeof(uint32));
+	data >>= fShift;
+	data &= fMask;
 
+	bool valid;
 	if (Signed()) {
 		// sign extend if needed.
-		if ((fData & ~(fMask >> 1)) != 0)
-			fData |= ~fMask;
+		if ((data & ~(fMask >> 1)) != 0)
+			data |= ~fMask;
 
-		fValid = (int32)fData >= (int32)fMinimum
-			&& (int32)fData <= (int32)fMaximum;
+		valid = (int32)data >= (int32)fMinimum
+			&& (int32)data <= (int32)fMaximum;
 	} else
-		fValid = fData >= fMinimum && fData <= fMaximum;
+		valid = data >= fMinimum && data <= fMaximum;
 
-	return B_OK;
+	*_data = data;
+	return valid ? B_OK : B_BAD_VALUE;
 }
 
 
@@ -129,14 +143,16 @@ HIDReportItem::PrintToStream(uint32 indentLevel)
 	indent[indentLevel] = 0;
 
 	TRACE_ALWAYS("%sHIDReportItem %p\n", indent, this);
-	TRACE_ALWAYS("%s\tbyte offset: %lu\n", indent, fByteOffset);
+	TRACE_ALWAYS("%s\tbyte offset: %" B_PRIu32 "\n", indent, fByteOffset);
 	TRACE_ALWAYS("%s\tshift: %u\n", indent, fShift);
-	TRACE_ALWAYS("%s\tmask: 0x%08lx\n", indent, fMask);
+	TRACE_ALWAYS("%s\tmask: 0x%08" B_PRIx32 "\n", indent, fMask);
 	TRACE_ALWAYS("%s\thas data: %s\n", indent, fHasData ? "yes" : "no");
 	TRACE_ALWAYS("%s\tarray: %s\n", indent, fArray ? "yes" : "no");
 	TRACE_ALWAYS("%s\trelative: %s\n", indent, fRelative ? "yes" : "no");
-	TRACE_ALWAYS("%s\tminimum: %lu\n", indent, fMinimum);
-	TRACE_ALWAYS("%s\tmaximum: %lu\n", indent, fMaximum);
-	TRACE_ALWAYS("%s\tusage minimum: 0x%08lx\n", indent, fUsageMinimum);
-	TRACE_ALWAYS("%s\tusage maximum: 0x%08lx\n", indent, fUsageMaximum);
+	TRACE_ALWAYS("%s\tminimum: %" B_PRIu32 "\n", indent, fMinimum);
+	TRACE_ALWAYS("%s\tmaximum: %" B_PRIu32 "\n", indent, fMaximum);
+	TRACE_ALWAYS("%s\tusage minimum: 0x%08" B_PRIx32 "\n", indent,
+		fUsageMinimum);
+	TRACE_ALWAYS("%s\tusage maximum: 0x%08" B_PRIx32 "\n", indent,
+		fUsageMaximum);
 }
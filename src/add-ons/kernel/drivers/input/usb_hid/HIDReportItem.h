@@ -29,6 +29,8 @@ public:
 		uint32					UsageMaximum() { return fUsageMaximum; };
 
 		status_t				Extract();
+		status_t				ExtractFrom(const uint8 *report,
+									uint32 *data);
 		status_t				Insert();
 
 		status_t				SetData(uint32 data);
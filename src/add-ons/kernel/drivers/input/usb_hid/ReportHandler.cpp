@@ -6,39 +6,127 @@
 #include "HIDReportItem.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <ring_buffer.h>
+#include <util/AutoLock.h>
 
 #include "uis_driver.h"
 
 
 static const size_t kRingBufferSize = 512;
+static const float kDefaultDeadzone = 1.0f;
+	// in logical units, what used to be the fixed clamp around the center
 
 
 #ifdef TRACE
 #undef TRACE
 #define TRACE(a...) dprintf("\33[34musb_hid_uis:\33[0m " a)
 #endif
+/*!	Returns the value of the item relative to the center of its logical
+	range.
+*/
+static float
+centered_value(HIDReportItem *item, uint32 data)
+{
+	if (item->Signed()) {
+		return (int32) data
+			- ((int32) item->Minimum() + (int32) item->Maximum()) / 2.0f;
+	}
+
+	return (float) data - (item->Minimum() + item->Maximum()) / 2.0f;
+}
+
+
 ReportHandler::ReportHandler(HIDReport *report)
 	:
 	fStatus(B_NO_INIT),
 	fReport(report),
-	fRingBuffer(NULL)
+	fRingBuffer(NULL),
+	fRingBufferSize(0),
+	fItemStates(NULL),
+	fInterestingItems(NULL),
+	fInterestingCount(0),
+	fRelativeItems(NULL),
+	fRelativeCount(0),
+	fLastReport(NULL),
+	fHasLastReport(false),
+	fHasPendingDeltas(false)
 {
-	fRingBuffer = create_ring_buffer(kRingBufferSize);
+	mutex_init(&fInterestLock, "usb hid report interest");
+	B_INITIALIZE_SPINLOCK(&fDeltaLock);
+	memset(&fStats, 0, sizeof(fStats));
+
+	// records are never split, so the largest one has to fit
+	fRingBufferSize = max_c(kRingBufferSize, sizeof(uis_report_data)
+		+ sizeof(uis_item_data) * fReport->CountItems());
+	fRingBuffer = create_ring_buffer(fRingBufferSize);
 	if (fRingBuffer == NULL) {
 		TRACE("failed to create requested ring buffer\n");
 		fStatus = B_NO_MEMORY;
 		return;
 	}
 
+	uint32 itemCount = fReport->CountItems();
+	fItemStates = (item_state *) malloc(sizeof(item_state) * itemCount);
+	fInterestingItems = (uint32 *) malloc(sizeof(uint32) * itemCount);
+	fRelativeItems = (uint32 *) malloc(sizeof(uint32) * itemCount);
+	if ((fItemStates == NULL || fInterestingItems == NULL
+			|| fRelativeItems == NULL) && itemCount > 0) {
+		TRACE("no memory for item states\n");
+		fStatus = B_NO_MEMORY;
+		return;
+	}
+
+	fLastReport = (uint8 *) calloc(fReport->ReportSize() + sizeof(uint32), 1);
+		// the extraction reads whole words
+	if (fLastReport == NULL) {
+		fStatus = B_NO_MEMORY;
+		return;
+	}
+
+	for (uint32 i = 0; i < itemCount; i++) {
+		HIDReportItem *item = fReport->ItemAt(i);
+		fItemStates[i].deadzone = kDefaultDeadzone;
+		fItemStates[i].hysteresis = 0.0f;
+		fItemStates[i].lastValue = 0.0f;
+		fItemStates[i].pendingDelta = 0.0f;
+		fItemStates[i].interesting = item != NULL && item->HasData();
+		fItemStates[i].refresh = false;
+		if (fItemStates[i].interesting)
+			fInterestingItems[fInterestingCount++] = i;
+		if (fItemStates[i].interesting && item->Relative()
+			&& item->Maximum() - item->Minimum() != 1)
+			fRelativeItems[fRelativeCount++] = i;
+	}
+
+	fReport->SetMissedReportHook(_MissedReportHook, this);
 	fStatus = B_OK;
 }
 
 
 ReportHandler::~ReportHandler()
 {
+	fReport->SetMissedReportHook(NULL, NULL);
 	if (fRingBuffer)
 		delete_ring_buffer(fRingBuffer);
+	free(fItemStates);
+	free(fInterestingItems);
+	free(fRelativeItems);
+	free(fLastReport);
+	mutex_destroy(&fInterestLock);
+}
+
+
+void
+ReportHandler::GetStats(uis_report_stats *stats, bool reset)
+{
+	stats->wakeups = read_counter(&fStats.wakeups, reset);
+	stats->interruptedWakeups = read_counter(&fStats.interruptedWakeups,
+		reset);
+	stats->reports = read_counter(&fStats.reports, reset);
+	stats->records = read_counter(&fStats.records, reset);
+	stats->ringOverflows = read_counter(&fStats.ringOverflows, reset);
+	stats->missedReports = read_counter(&fStats.missedReports, reset);
 }
 
 
@@ -64,7 +152,11 @@ ReportHandler::Control(uint32 op, void *buffer, size_t length)
 				status_t result;
 
 				while (_RingBufferReadable() == 0) {
-					result = _ReadReport();
+					// hand out the motion gathered while we were away first
+					if (fHasPendingDeltas)
+						result = _WritePendingDeltas();
+					else
+						result = _ReadReport();
 					if (result != B_OK)
 						return result;
 				}
@@ -98,75 +190,468 @@ ReportHandler::Control(uint32 op, void *buffer, size_t length)
 			fReport->SetReport(B_ERROR, NULL, 0);
 				// fake report for releasing
 			return B_OK;
+
+		case UIS_READ_RAW:
+			return _ReadRawReport((uis_raw_report *) buffer);
+
+		case UIS_SET_FILTER:
+			return _SetFilter((uis_item_filter *) buffer);
+
+		case UIS_GET_FILTER:
+			return _GetFilter((uis_item_filter *) buffer);
+
+		case UIS_SET_INTEREST:
+			return _SetInterest((uis_interest_info *) buffer);
+
+		case UIS_GET_VALUE:
+			return _GetValue((uis_item_value *) buffer);
 	}
 
 	return B_DEV_INVALID_IOCTL;
 }
 
 
+/*!	Waits for the next report. Returns B_INTERRUPTED if the caller should
+	simply try again, and B_OK if the report has to be processed and released
+	with DoneProcessing().
+*/
 status_t
-ReportHandler::_ReadReport()
+ReportHandler::_WaitForReport()
 {
 	status_t result = fReport->WaitForReport(B_INFINITE_TIMEOUT);
-	if (result != B_OK) {
-		if (fReport->Device()->IsRemoved()) {
-			TRACE("device has been removed\n");
-			return B_DEV_NOT_READY;
-		}
+	atomic_add(&fStats.wakeups, 1);
+	if (result == B_OK) {
+		atomic_add(&fStats.reports, 1);
+		return B_OK;
+	}
 
-		if (result == B_ERROR)
-			return B_ERROR;
-				// wake and exit thread
+	if (result == B_INTERRUPTED)
+		atomic_add(&fStats.interruptedWakeups, 1);
 
-		if (result != B_INTERRUPTED) {
-			// interrupts happen when other reports come in on the same
-			// input as ours
-			TRACE("error waiting for report: %s\n", strerror(result));
-		}
+	if (fReport->Device()->IsRemoved()) {
+		TRACE("device has been removed\n");
+		return B_DEV_NOT_READY;
+	}
 
-		return B_OK;
+	if (result == B_ERROR)
+		return B_ERROR;
+			// wake and exit thread
+
+	if (result != B_INTERRUPTED) {
+		// interrupts happen when other reports come in on the same
+		// input as ours
+		TRACE("error waiting for report: %s\n", strerror(result));
+	}
+
+	return B_INTERRUPTED;
+}
+
+
+status_t
+ReportHandler::_ReadReport()
+{
+	status_t result = _WaitForReport();
+	if (result != B_OK) {
+		return (result == B_INTERRUPTED) ? B_OK : result;
 			// signal that we simply want to try again
 	}
 
+	_StoreLastReport(fReport->CurrentReport());
+
 	size_t size = sizeof(uis_report_data);
 	uis_report_data *data = (uis_report_data *) malloc(size
 			+ sizeof(uis_item_data) * fReport->CountItems());
+	if (data == NULL) {
+		fReport->DoneProcessing();
+		return B_NO_MEMORY;
+	}
 	data->items = 0;
 
-	HIDReportItem *item;
-	for (uint32 i = 0; i<fReport->CountItems(); i++) {
-		item = fReport->ItemAt(i);
-		if (item == NULL || !item->HasData())
+	MutexLocker locker(fInterestLock);
+	for (uint32 n = 0; n < fInterestingCount; n++) {
+		uint32 i = fInterestingItems[n];
+		HIDReportItem *item = fReport->ItemAt(i);
+		item_state *state = &fItemStates[i];
+		if (item->Extract() != B_OK || !item->Valid())
 			continue;
-		if (item->Extract() == B_OK && item->Valid()
-				&& item->HasDataChanged()) {
-			data->item[data->items].index = i;
 
-			if (item->Maximum() - item->Minimum() == 1) {
-				data->item[data->items++].value
-					= (item->Data() == item->Maximum()) ? 1.0f : 0.0f;
+		// items that just became interesting report their current value
+		bool refresh = state->refresh;
+		state->refresh = false;
+
+		if (item->Maximum() - item->Minimum() == 1) {
+			if (!item->HasDataChanged() && !refresh)
+				continue;
+			data->item[data->items].index = i;
+			data->item[data->items++].value
+				= (item->Data() == item->Maximum()) ? 1.0f : 0.0f;
+		} else {
+			float scale = 2.0f / (item->Maximum() - item->Minimum());
+			float value = centered_value(item, item->Data());
+			if (item->Relative()) {
+				value *= scale;
+				if (value == 0.0f)
+					continue;
 			} else {
-				float value = (float) item->Data() - (item->Minimum()
-					+ item->Maximum()) / 2.0f;
-				if (value > -1.0f && value < 1.0f)
-					value = 0.0f;
-				value *= 2.0f / (item->Maximum() - item->Minimum());
-				data->item[data->items++].value = value;
+				if (!_FilterValue(state, &value) && !refresh)
+					continue;
+				value *= scale;
 			}
+			data->item[data->items].index = i;
+			data->item[data->items++].value = value;
 		}
 	}
 
+	// the motion of the reports nobody was waiting for
+	_AddPendingDeltas(data);
+	locker.Unlock();
+
+	data->timestamp = fReport->ReportTime();
 	fReport->DoneProcessing();
 	size += sizeof(uis_item_data) * data->items;
 
-	result = _RingBufferWrite(data, size);
+	if (data->items > 0) {
+		data->written = system_time();
+		result = _RingBufferWrite(data, size);
+	}
+			// nothing changed past the filters, don't wake up the reader
+
+	free(data);
+
+	return result;
+}
+
+
+/*!	Writes a record of the pending deltas alone, for when there is no
+	report to carry them, so that they don't wait for the next one.
+*/
+status_t
+ReportHandler::_WritePendingDeltas()
+{
+	uis_report_data *data = (uis_report_data *) malloc(
+		sizeof(uis_report_data) + sizeof(uis_item_data) * fRelativeCount);
+	if (data == NULL)
+		return B_NO_MEMORY;
+	data->items = 0;
+
+	MutexLocker locker(fInterestLock);
+	_AddPendingDeltas(data);
+	locker.Unlock();
+
+	status_t result = B_OK;
+	if (data->items > 0) {
+		data->timestamp = fReport->ReportTime();
+		data->written = system_time();
+		result = _RingBufferWrite(data, sizeof(uis_report_data)
+			+ sizeof(uis_item_data) * data->items);
+	}
 
 	free(data);
+	return result;
+}
+
+
+/*!	Folds the pending deltas into the record, adding them to the values of
+	items that are in it already, so that they don't take a record of their
+	own. The record needs room for all relative items that aren't in it.
+	Called with fInterestLock held.
+*/
+void
+ReportHandler::_AddPendingDeltas(uis_report_data *data)
+{
+	_SetHasPendingDeltas(false);
+		// a sum added after this sets the flag again
+	for (uint32 n = 0; n < fRelativeCount; n++) {
+		uint32 i = fRelativeItems[n];
+		if (!fItemStates[i].interesting)
+			continue;
+
+		float delta = _TakePendingDelta(&fItemStates[i]);
+		if (delta == 0.0f)
+			continue;
+
+		int32 k = 0;
+		while (k < data->items && data->item[k].index != (int32) i)
+			k++;
+		if (k == data->items) {
+			data->item[k].index = i;
+			data->item[k].value = 0.0f;
+			data->items++;
+		}
+		data->item[k].value += delta;
+	}
+}
+
+
+void
+ReportHandler::_MissedReportHook(HIDReport *report, void *cookie)
+{
+	((ReportHandler *) cookie)->_AccumulateDeltas();
+}
+
+
+/*!	Called with the reports that come in while the reader is busy elsewhere,
+	for example when another report of the device was asked for. Instead of
+	losing their motion, the relative items are summed up until the next
+	read.
+	This runs in the transfer callback, so it must not block: it only takes
+	fDeltaLock around the sums, reads the interest flags unlocked, and
+	extracts into locals, leaving the item state to the reader.
+*/
+void
+ReportHandler::_AccumulateDeltas()
+{
+	atomic_add(&fStats.missedReports, 1);
+
+	const uint8 *report = fReport->CurrentReport();
+	if (report == NULL)
+		return;
 
+	_StoreLastReport(report);
+
+	for (uint32 n = 0; n < fRelativeCount; n++) {
+		uint32 i = fRelativeItems[n];
+		HIDReportItem *item = fReport->ItemAt(i);
+		item_state *state = &fItemStates[i];
+		uint32 data;
+		if (!state->interesting || item->ExtractFrom(report, &data) != B_OK)
+			continue;
+
+		float value = centered_value(item, data);
+		if (value == 0.0f)
+			continue;
+
+		InterruptsSpinLocker locker(fDeltaLock);
+		state->pendingDelta += value * 2.0f
+			/ (item->Maximum() - item->Minimum());
+		fHasPendingDeltas = true;
+	}
+}
+
+
+/*!	Keeps a copy of the report for _GetValue(), as the transfer buffer is
+	reused for the next one. Called from the transfer callback as well.
+*/
+void
+ReportHandler::_StoreLastReport(const uint8 *report)
+{
+	InterruptsSpinLocker locker(fDeltaLock);
+	memcpy(fLastReport, report, fReport->ReportSize());
+	fHasLastReport = true;
+}
+
+
+float
+ReportHandler::_TakePendingDelta(item_state *state)
+{
+	InterruptsSpinLocker locker(fDeltaLock);
+	float delta = state->pendingDelta;
+	state->pendingDelta = 0.0f;
+	return delta;
+}
+
+
+void
+ReportHandler::_SetHasPendingDeltas(bool hasPendingDeltas)
+{
+	InterruptsSpinLocker locker(fDeltaLock);
+	fHasPendingDeltas = hasPendingDeltas;
+}
+
+
+status_t
+ReportHandler::_ReadRawReport(uis_raw_report *info)
+{
+	status_t result;
+	do {
+		result = _WaitForReport();
+	} while (result == B_INTERRUPTED);
+	if (result != B_OK)
+		return result;
+
+	_StoreLastReport(fReport->CurrentReport());
+
+	size_t size = fReport->ReportSize();
+	info->id = fReport->ID();
+	info->timestamp = fReport->ReportTime();
+	result = user_memcpy(info->data, fReport->CurrentReport(),
+		min_c(size, info->length));
+	info->length = size;
+
+	fReport->DoneProcessing();
 	return result;
 }
 
 
+/*!	Applies the deadzone and hysteresis of an absolute item to its centered
+	value. Returns false if the filtered value is not worth reporting.
+*/
+bool
+ReportHandler::_FilterValue(item_state *state, float *value)
+{
+	if (*value > -state->deadzone && *value < state->deadzone)
+		*value = 0.0f;
+
+	float delta = *value - state->lastValue;
+	if (delta == 0.0f)
+		return false;
+	if (*value != 0.0f && delta > -state->hysteresis
+			&& delta < state->hysteresis) {
+		// moving back to the center is always reported
+		return false;
+	}
+
+	state->lastValue = *value;
+	return true;
+}
+
+
+status_t
+ReportHandler::SetFilter(int32 index, float deadzone, float hysteresis)
+{
+	uis_item_filter info;
+	info.report = this;
+	info.index = index;
+	info.deadzone = deadzone;
+	info.hysteresis = hysteresis;
+	return _SetFilter(&info);
+}
+
+
+status_t
+ReportHandler::_SetFilter(uis_item_filter *info)
+{
+	if (info->deadzone < 0.0f || info->deadzone > 1.0f
+			|| info->hysteresis < 0.0f || info->hysteresis > 1.0f)
+		return B_BAD_VALUE;
+
+	int32 first = info->index, last = info->index;
+	if (info->index == -1) {
+		first = 0;
+		last = fReport->CountItems() - 1;
+	} else if (info->index < 0 || info->index >= (int32) fReport->CountItems())
+		return B_BAD_INDEX;
+
+	for (int32 i = first; i <= last; i++) {
+		HIDReportItem *item = fReport->ItemAt(i);
+		if (item == NULL)
+			continue;
+		float scale = (item->Maximum() - item->Minimum()) / 2.0f;
+		fItemStates[i].deadzone = info->deadzone * scale;
+		fItemStates[i].hysteresis = info->hysteresis * scale;
+	}
+
+	return B_OK;
+}
+
+
+status_t
+ReportHandler::_GetFilter(uis_item_filter *info)
+{
+	if (info->index < 0 || info->index >= (int32) fReport->CountItems())
+		return B_BAD_INDEX;
+
+	HIDReportItem *item = fReport->ItemAt(info->index);
+	if (item == NULL || item->Maximum() == item->Minimum())
+		return B_BAD_INDEX;
+
+	float scale = (item->Maximum() - item->Minimum()) / 2.0f;
+	info->deadzone = fItemStates[info->index].deadzone / scale;
+	info->hysteresis = fItemStates[info->index].hysteresis / scale;
+	return B_OK;
+}
+
+
+status_t
+ReportHandler::_SetInterest(uis_interest_info *info)
+{
+	uint8 *mask = NULL;
+	if (info->mask != NULL) {
+		if (info->count < 0)
+			return B_BAD_VALUE;
+
+		size_t size = (info->count + 7) / 8;
+		mask = (uint8 *) malloc(size);
+		if (mask == NULL && size > 0)
+			return B_NO_MEMORY;
+		if (user_memcpy(mask, info->mask, size) != B_OK) {
+			free(mask);
+			return B_BAD_ADDRESS;
+		}
+	}
+
+	MutexLocker locker(fInterestLock);
+	fInterestingCount = 0;
+	for (uint32 i = 0; i < fReport->CountItems(); i++) {
+		HIDReportItem *item = fReport->ItemAt(i);
+		bool interesting = item != NULL && item->HasData()
+			&& (info->mask == NULL || ((int32) i < info->count
+				&& (mask[i / 8] & (1 << (i % 8))) != 0));
+
+		if (interesting && !fItemStates[i].interesting)
+			fItemStates[i].refresh = true;
+		fItemStates[i].interesting = interesting;
+		if (interesting)
+			fInterestingItems[fInterestingCount++] = i;
+	}
+
+	locker.Unlock();
+	free(mask);
+	return B_OK;
+}
+
+
+/*!	Gets the value of an item in the last report that came in, whether the
+	item was of interest then or not, without waiting for the next report
+	that might never come for a device at rest. Nothing is sent to the
+	device. Returns B_NO_INIT if no report came in yet.
+*/
+status_t
+ReportHandler::_GetValue(uis_item_value *info)
+{
+	HIDReportItem *item = fReport->ItemAt(info->index);
+	if (item == NULL || !item->HasData())
+		return B_BAD_INDEX;
+
+	if (item->Relative()) {
+		// there's no motion outside of the reports
+		info->value = 0.0f;
+		return B_OK;
+	}
+
+	size_t size = fReport->ReportSize() + sizeof(uint32);
+	uint8 *report = (uint8 *) malloc(size);
+	if (report == NULL)
+		return B_NO_MEMORY;
+
+	bool hasReport;
+	{
+		InterruptsSpinLocker locker(fDeltaLock);
+		hasReport = fHasLastReport;
+		if (hasReport)
+			memcpy(report, fLastReport, size);
+	}
+
+	uint32 data;
+	status_t result = hasReport ? item->ExtractFrom(report, &data) : B_NO_INIT;
+	free(report);
+	if (result != B_OK)
+		return result;
+
+	if (item->Maximum() - item->Minimum() == 1) {
+		info->value = (data == item->Maximum()) ? 1.0f : 0.0f;
+		return B_OK;
+	}
+
+	float value = centered_value(item, data);
+	float deadzone = fItemStates[info->index].deadzone;
+	if (value > -deadzone && value < deadzone)
+		value = 0.0f;
+	info->value = value * 2.0f / (item->Maximum() - item->Minimum());
+	return B_OK;
+}
+
+
 int32
 ReportHandler::_RingBufferReadable()
 {
@@ -185,6 +670,21 @@ ReportHandler::_RingBufferRead(void *buffer, size_t length)
 status_t
 ReportHandler::_RingBufferWrite(const void *buffer, size_t length)
 {
+	if (length > fRingBufferSize) {
+		// the ring is made to fit the largest record
+		TRACE_ALWAYS("record of %lu bytes doesn't fit the ring\n", length);
+		atomic_add(&fStats.ringOverflows, 1);
+		return B_BUFFER_OVERFLOW;
+	}
+
+	if ((size_t) ring_buffer_writable(fRingBuffer) < length) {
+		// a partial record would corrupt the ones following it, this one
+		// is dropped and counted
+		atomic_add(&fStats.ringOverflows, 1);
+		return B_OK;
+	}
+
 	ring_buffer_write(fRingBuffer, (const uint8 *) buffer, length);
+	atomic_add(&fStats.records, 1);
 	return B_OK;
 }
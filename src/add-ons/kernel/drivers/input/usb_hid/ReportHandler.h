@@ -2,9 +2,22 @@
 #define _REPORT_HANDLER_H
 
 #include <SupportDefs.h>
+#include <KernelExport.h>
+#include <lock.h>
+
+#include "uis_driver.h"
 
 class HIDReport;
 
+struct item_state {
+	float					deadzone;
+	float					hysteresis;
+	float					lastValue;
+	float					pendingDelta;
+	bool					interesting;
+	bool					refresh;
+};
+
 class ReportHandler {
 public:
 							ReportHandler(HIDReport *report);
@@ -16,8 +29,28 @@ public:
 
 	status_t				Control(uint32 op, void *buffer, size_t length);
 
+	void					GetStats(uis_report_stats *stats, bool reset);
+	status_t				SetFilter(int32 index, float deadzone,
+								float hysteresis);
+
 private:
+	status_t				_WaitForReport();
 	status_t				_ReadReport();
+	status_t				_WritePendingDeltas();
+	static void				_MissedReportHook(HIDReport *report,
+								void *cookie);
+	void					_AddPendingDeltas(uis_report_data *data);
+	void					_AccumulateDeltas();
+	void					_StoreLastReport(const uint8 *report);
+	float					_TakePendingDelta(item_state *state);
+	void					_SetHasPendingDeltas(bool hasPendingDeltas);
+	status_t				_ReadRawReport(uis_raw_report *info);
+	bool					_FilterValue(item_state *state, float *value);
+
+	status_t				_SetFilter(uis_item_filter *info);
+	status_t				_GetFilter(uis_item_filter *info);
+	status_t				_SetInterest(uis_interest_info *info);
+	status_t				_GetValue(uis_item_value *info);
 
 	int32					_RingBufferReadable();
 	status_t				_RingBufferRead(void *buffer, size_t length);
@@ -26,6 +59,24 @@ private:
 	status_t				fStatus;
 	HIDReport *				fReport;
 	struct ring_buffer *	fRingBuffer;
+	size_t					fRingBufferSize;
+	item_state *			fItemStates;
+
+	mutex					fInterestLock;
+	uint32 *				fInterestingItems;
+	uint32					fInterestingCount;
+
+	spinlock				fDeltaLock;
+		// guards the pending deltas, that the transfer callback adds to, and
+		// the copy of the last report
+	uint8 *					fLastReport;
+	bool					fHasLastReport;
+	uint32 *				fRelativeItems;
+	uint32					fRelativeCount;
+		// the items _AccumulateDeltas() looks at, never changes
+	bool					fHasPendingDeltas;
+
+	uis_report_stats		fStats;
 };
 
 #endif // _REPORT_HANDLER_H
@@ -0,0 +1,440 @@
+#include "HIDPlatform.h"
+#include "HIDParser.h"
+#include "HIDReport.h"
+#include "HIDReportItem.h"
+
+#include <OS.h>
+
+#include <limits.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static int64 sAllocations = 0;
+static int64 sFrees = 0;
+
+
+// Allocations and frees are counted by interposing the allocator, which is
+// only done for glibc. operator new and delete go through malloc() and free()
+// there as well. A realloc() of an existing block counts as both.
+#ifdef __GLIBC__
+#define COUNT_ALLOCATIONS
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void __libc_free(void *pointer);
+}
+
+
+extern "C" void *
+malloc(size_t size)
+{
+	sAllocations++;
+	return __libc_malloc(size);
+}
+
+
+extern "C" void *
+calloc(size_t count, size_t size)
+{
+	sAllocations++;
+	return __libc_calloc(count, size);
+}
+
+
+extern "C" void *
+realloc(void *pointer, size_t size)
+{
+	if (pointer != NULL)
+		sFrees++;
+	if (pointer == NULL || size != 0)
+		sAllocations++;
+	return __libc_realloc(pointer, size);
+}
+
+
+extern "C" void
+free(void *pointer)
+{
+	if (pointer != NULL)
+		sFrees++;
+	__libc_free(pointer);
+}
+#endif
+
+
+// Built in part of the corpus: the boot protocol descriptors from the HID
+// specification (appendix E.6 and E.10) and a synthetic gamepad layout with a
+// report ID and a hat switch. No captures of real devices are checked in;
+// their descriptors can be dumped by the driver, see
+// HIDDevice::DumpReportDescriptor(), and be passed in together with their
+// reports.
+
+static const uint8 kBootKeyboard[] = {
+	0x05, 0x01, 0x09, 0x06, 0xa1, 0x01, 0x05, 0x07, 0x19, 0xe0, 0x29, 0xe7,
+	0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01,
+	0x75, 0x08, 0x81, 0x01, 0x95, 0x05, 0x75, 0x01, 0x05, 0x08, 0x19, 0x01,
+	0x29, 0x05, 0x91, 0x02, 0x95, 0x01, 0x75, 0x03, 0x91, 0x01, 0x95, 0x06,
+	0x75, 0x08, 0x15, 0x00, 0x25, 0x65, 0x05, 0x07, 0x19, 0x00, 0x29, 0x65,
+	0x81, 0x00, 0xc0
+};
+
+static const uint8 kBootMouse[] = {
+	0x05, 0x01, 0x09, 0x02, 0xa1, 0x01, 0x09, 0x01, 0xa1, 0x00, 0x05, 0x09,
+	0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x95, 0x03, 0x75, 0x01,
+	0x81, 0x02, 0x95, 0x01, 0x75, 0x05, 0x81, 0x01, 0x05, 0x01, 0x09, 0x30,
+	0x09, 0x31, 0x15, 0x81, 0x25, 0x7f, 0x75, 0x08, 0x95, 0x02, 0x81, 0x06,
+	0xc0, 0xc0
+};
+
+static const uint8 kGamepad[] = {
+	0x05, 0x01, 0x09, 0x05, 0xa1, 0x01, 0x85, 0x01, 0x05, 0x09, 0x19, 0x01,
+	0x29, 0x10, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x10, 0x81, 0x02,
+	0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x09, 0x32, 0x09, 0x35, 0x15, 0x00,
+	0x26, 0xff, 0x00, 0x75, 0x08, 0x95, 0x04, 0x81, 0x02, 0x09, 0x39, 0x15,
+	0x00, 0x25, 0x07, 0x35, 0x00, 0x46, 0x3b, 0x01, 0x65, 0x14, 0x75, 0x04,
+	0x95, 0x01, 0x81, 0x42, 0x75, 0x04, 0x95, 0x01, 0x81, 0x01, 0xc0
+};
+
+
+struct corpus_entry {
+	const char *	name;
+	const uint8 *	descriptor;
+	size_t			descriptorLength;
+	uint8 *			reports;
+		// captured reports, each one prefixed by its length in a byte
+	size_t			reportsLength;
+};
+
+
+struct replay_report {
+	uint8 *			data;
+	size_t			length;
+};
+
+
+static void
+usage(const char *program)
+{
+	fprintf(stderr, "usage: %s [-i <iterations>] [-r <reports>] "
+			"[<descriptor> ...]\n"
+		"Parses report descriptors and extracts the items of reports with the\n"
+		"usb_hid parser, and reports the time and allocations per descriptor\n"
+		"and per report. Reports captured from a device are read from\n"
+		"<descriptor>.reports, as a sequence of reports as they came from the\n"
+		"device, each one prefixed by its length in a byte. Reports with\n"
+		"random values in the logical range of each item are generated for\n"
+		"the descriptors without captured reports, including the built in\n"
+		"ones.\n"
+		"  -i  times each descriptor is parsed (default 10000)\n"
+		"  -r  reports extracted per descriptor (default 1000000)\n",
+		program);
+	exit(1);
+}
+
+
+static uint8 *
+read_file(const char *path, size_t &length)
+{
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return NULL;
+
+	uint8 *data = NULL;
+	length = 0;
+	if (fseek(file, 0, SEEK_END) == 0) {
+		long size = ftell(file);
+		if (size > 0 && fseek(file, 0, SEEK_SET) == 0) {
+			data = (uint8 *) malloc(size);
+			if (data != NULL && fread(data, size, 1, file) == 1)
+				length = size;
+			else {
+				free(data);
+				data = NULL;
+			}
+		}
+	}
+
+	fclose(file);
+	return data;
+}
+
+
+/*!	Fills in a report with random values within the logical range of each
+	item, so that the extraction takes the same paths as for a real device.
+*/
+static void
+generate_report(HIDReport *input, uint8 *data)
+{
+	input->SetReport(B_OK, data, input->ReportSize());
+
+	for (uint32 i = 0; i < input->CountItems(); i++) {
+		HIDReportItem *item = input->ItemAt(i);
+		if (item == NULL || !item->HasData())
+			continue;
+
+		uint32 range = item->Maximum() - item->Minimum();
+		uint32 value = item->Minimum();
+		if (range != UINT32_MAX)
+			value += (uint32) rand() % (range + 1);
+		else
+			value += (uint32) rand();
+
+		item->SetData(value);
+		item->Insert();
+	}
+
+	input->SetReport(B_ERROR, NULL, 0);
+}
+
+
+/*!	Lays out the reports at a fixed stride of the largest report plus four
+	bytes, as HIDReportItem::Extract() always reads four bytes, and generates
+	them when there are no captured reports.
+*/
+static replay_report *
+prepare_reports(HIDParser &parser, const corpus_entry &entry, int32 &count,
+	uint8 *&buffer)
+{
+	size_t stride = parser.MaxReportSize() + sizeof(uint32);
+	uint8 inputCount = parser.CountReports(HID_REPORT_TYPE_INPUT);
+	if (inputCount == 0)
+		return NULL;
+
+	count = 0;
+	if (entry.reports != NULL) {
+		for (size_t offset = 0; offset < entry.reportsLength;
+				offset += entry.reports[offset] + 1) {
+			count++;
+		}
+	} else
+		count = 1000;
+	if (count == 0)
+		return NULL;
+
+	replay_report *reports
+		= (replay_report *) malloc(count * sizeof(replay_report));
+	buffer = (uint8 *) calloc(count, stride);
+	if (reports == NULL || buffer == NULL) {
+		free(reports);
+		free(buffer);
+		return NULL;
+	}
+
+	size_t offset = 0;
+	srand(count);
+	for (int32 i = 0; i < count; i++) {
+		replay_report &report = reports[i];
+		report.data = buffer + i * stride;
+
+		if (entry.reports != NULL) {
+			report.length = entry.reports[offset];
+			if (report.length > stride - sizeof(uint32)
+				|| offset + 1 + report.length > entry.reportsLength) {
+				count = i;
+				break;
+			}
+
+			memcpy(report.data, entry.reports + offset + 1, report.length);
+			offset += report.length + 1;
+			continue;
+		}
+
+		HIDReport *input = parser.ReportAt(HID_REPORT_TYPE_INPUT,
+			i % inputCount);
+		uint8 *data = report.data;
+		report.length = input->ReportSize();
+		if (parser.UsesReportIDs()) {
+			*data++ = input->ID();
+			report.length++;
+		}
+
+		generate_report(input, data);
+	}
+
+	if (count == 0) {
+		free(reports);
+		free(buffer);
+		return NULL;
+	}
+
+	return reports;
+}
+
+
+struct benchmark_result {
+	double			parseTime;
+	double			parseAllocations;
+	double			parseLeaks;
+		// allocations not freed again, per parse
+	double			reportTime;
+	double			reportAllocations;
+	double			reportLeaks;
+};
+
+
+static void
+run_benchmark(const corpus_entry &entry, int32 iterations, int64 maxReports,
+	benchmark_result &result)
+{
+	memset(&result, 0, sizeof(result));
+
+	int64 allocations = sAllocations;
+	int64 frees = sFrees;
+	bigtime_t start = system_time();
+	for (int32 i = 0; i < iterations; i++) {
+		HIDParser parser(NULL);
+		parser.ParseReportDescriptor(entry.descriptor,
+			entry.descriptorLength);
+	}
+	result.parseTime = (system_time() - start) * 1000.0 / iterations;
+	result.parseAllocations = (double) (sAllocations - allocations)
+		/ iterations;
+	result.parseLeaks = (double) ((sAllocations - allocations)
+		- (sFrees - frees)) / iterations;
+
+	HIDParser parser(NULL);
+	if (parser.ParseReportDescriptor(entry.descriptor, entry.descriptorLength)
+			!= B_OK) {
+		fprintf(stderr, "%s: parsing failed\n", entry.name);
+		return;
+	}
+
+	int32 count;
+	uint8 *buffer = NULL;
+	replay_report *reports = prepare_reports(parser, entry, count, buffer);
+	if (reports == NULL)
+		return;
+
+	uint8 inputCount = parser.CountReports(HID_REPORT_TYPE_INPUT);
+	HIDReport **inputs = new(std::nothrow) HIDReport *[inputCount];
+	if (inputs == NULL) {
+		free(reports);
+		free(buffer);
+		return;
+	}
+
+	for (uint8 i = 0; i < inputCount; i++)
+		inputs[i] = parser.ReportAt(HID_REPORT_TYPE_INPUT, i);
+
+	// the same work the driver does for a report with everything interesting
+	int64 replayed = 0;
+	allocations = sAllocations;
+	frees = sFrees;
+	start = system_time();
+	while (replayed < maxReports) {
+		for (int32 i = 0; i < count && replayed < maxReports; i++) {
+			parser.SetReport(B_OK, reports[i].data, reports[i].length);
+			replayed++;
+
+			for (uint8 r = 0; r < inputCount; r++) {
+				HIDReport *input = inputs[r];
+				if (input->CurrentReport() == NULL)
+					continue;
+
+				for (uint32 n = 0; n < input->CountItems(); n++)
+					input->ItemAt(n)->Extract();
+			}
+		}
+	}
+	result.reportTime = (system_time() - start) * 1000.0 / replayed;
+	result.reportAllocations = (double) (sAllocations - allocations)
+		/ replayed;
+	result.reportLeaks = (double) ((sAllocations - allocations)
+		- (sFrees - frees)) / replayed;
+
+	parser.SetReport(B_ERROR, NULL, 0);
+		// don't leave the reports pointing into the buffer
+	delete[] inputs;
+	free(reports);
+	free(buffer);
+}
+
+
+int
+main(int argc, char **argv)
+{
+	int32 iterations = 10000;
+	int64 maxReports = 1000000;
+
+	const corpus_entry builtin[] = {
+		{ "boot keyboard", kBootKeyboard, sizeof(kBootKeyboard), NULL, 0 },
+		{ "boot mouse", kBootMouse, sizeof(kBootMouse), NULL, 0 },
+		{ "gamepad", kGamepad, sizeof(kGamepad), NULL, 0 }
+	};
+	const int32 builtinCount = sizeof(builtin) / sizeof(builtin[0]);
+
+	corpus_entry *corpus = new(std::nothrow) corpus_entry[builtinCount + argc];
+	if (corpus == NULL)
+		return 1;
+
+	int32 corpusCount = 0;
+	for (; corpusCount < builtinCount; corpusCount++)
+		corpus[corpusCount] = builtin[corpusCount];
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+			iterations = atoi(argv[++i]);
+			continue;
+		}
+		if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			maxReports = atoll(argv[++i]);
+			continue;
+		}
+		if (argv[i][0] == '-')
+			usage(argv[0]);
+
+		corpus_entry &entry = corpus[corpusCount];
+		entry.name = argv[i];
+		entry.descriptor = read_file(argv[i], entry.descriptorLength);
+		if (entry.descriptor == NULL) {
+			fprintf(stderr, "%s: could not read %s\n", argv[0], argv[i]);
+			return 1;
+		}
+
+		char reportsPath[PATH_MAX];
+		snprintf(reportsPath, sizeof(reportsPath), "%s.reports", argv[i]);
+		entry.reports = read_file(reportsPath, entry.reportsLength);
+		corpusCount++;
+	}
+
+	if (iterations < 1 || maxReports < 1)
+		usage(argv[0]);
+
+	// "allocs" is the number of allocations, "leaked" the part of them that
+	// wasn't freed again by the end of the parse or report
+	printf("%-32s %6s %8s %7s %7s %10s %7s %7s\n", "descriptor", "bytes",
+		"ns/parse", "allocs", "leaked", "ns/report", "allocs", "leaked");
+
+	double totalReportTime = 0, totalReportAllocations = 0;
+	for (int32 i = 0; i < corpusCount; i++) {
+		const corpus_entry &entry = corpus[i];
+		benchmark_result result;
+		run_benchmark(entry, iterations, maxReports, result);
+
+		const char *name = entry.name;
+		if (strlen(name) > 32)
+			name += strlen(name) - 32;
+		printf("%-32s %6lu %8.0f %7.1f %7.1f %10.1f %7.2f %7.2f%s\n", name,
+			(unsigned long) entry.descriptorLength, result.parseTime,
+			result.parseAllocations, result.parseLeaks, result.reportTime,
+			result.reportAllocations, result.reportLeaks,
+			entry.reports != NULL ? " (captured)" : "");
+
+		totalReportTime += result.reportTime;
+		totalReportAllocations += result.reportAllocations;
+	}
+
+	printf("mean: %.1f ns/report, %.2f allocations/report\n",
+		totalReportTime / corpusCount, totalReportAllocations / corpusCount);
+#ifndef COUNT_ALLOCATIONS
+	printf("allocations aren't counted on this host\n");
+#endif
+
+	delete[] corpus;
+	return 0;
+}
@@ -0,0 +1,577 @@
+#include <Looper.h>
+#include <Message.h>
+#include <OS.h>
+#include <UISKit.h>
+
+#include <input_globals.h>
+#include <InputServerTypes.h>
+#include <UISProtocol.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static const char kMockPathPrefix[] = "/dev/input/uis_mock/";
+static const char kMockName[] = "Mock Device ";
+static const bigtime_t kBringUpTimeout = 30000000;
+static const bigtime_t kFindTimeout = 5000000;
+static const bigtime_t kFindInterval = 50000;
+
+
+static void
+usage(const char *program)
+{
+	fprintf(stderr, "usage: %s [-n <calls>] [-m <devices>] [-d <name>]\n"
+		"       %s -s <seconds> -m <devices> [-t <threads>]\n"
+		"Measures the round trips of the UIS kit calls to the input_server and\n"
+		"prints their latency percentiles and calls per second.\n"
+		"  -n  calls per benchmark (default 10000)\n"
+		"  -m  adds mock devices for the run and removes them afterwards,\n"
+		"      needs an input_server built with UIS_MOCK_DEVICES. The time\n"
+		"      until all of them are up is printed as well\n"
+		"  -d  device to use, by default the first mock device, or the first\n"
+		"      device with an input report\n"
+		"  -s  instead of the benchmarks, looks up devices and sets item\n"
+		"      targets from several threads while the mock devices are added\n"
+		"      and removed over and over\n"
+		"  -t  lookup threads of the stress run (default 8)\n", program,
+		program);
+	exit(1);
+}
+
+
+static status_t
+send_command(BMessage &command, BMessage &reply)
+{
+	status_t status = _control_input_server_(&command, &reply);
+	if (status == B_OK && reply.FindInt32("status", &status) != B_OK)
+		status = B_ERROR;
+	return status;
+}
+
+
+static int
+compare_samples(const void *a, const void *b)
+{
+	bigtime_t first = *(const bigtime_t *) a;
+	bigtime_t second = *(const bigtime_t *) b;
+	return first < second ? -1 : (first > second ? 1 : 0);
+}
+
+
+static void
+print_header()
+{
+	printf("%-22s %8s %8s %8s %8s %12s %7s\n", "call", "p50 us", "p90 us",
+		"p99 us", "max us", "calls/s", "errors");
+}
+
+
+static void
+print_result(const char *name, bigtime_t *samples, int32 count, int32 errors)
+{
+	if (count == 0) {
+		printf("%-22s skipped\n", name);
+		return;
+	}
+
+	bigtime_t total = 0;
+	for (int32 i = 0; i < count; i++)
+		total += samples[i];
+
+	qsort(samples, count, sizeof(bigtime_t), compare_samples);
+	printf("%-22s %8lld %8lld %8lld %8lld %12.0f %7ld\n", name,
+		samples[count / 2], samples[count * 9 / 10], samples[count * 99 / 100],
+		samples[count - 1], total > 0 ? count * 1000000.0 / total : 0.0,
+		errors);
+}
+
+
+/*!	Every call is timed on its own. The first call on a roster also fetches
+	the device list, the others only get the device. The call that reports
+	the end of the list doesn't get a device and is left out.
+*/
+static void
+bench_get_next_device(bigtime_t *samples, int32 calls)
+{
+	int32 count = 0, errors = 0;
+	bool empty = false;
+	while (count < calls && !empty) {
+		BUISRoster roster;
+		int32 found = 0;
+		while (count < calls) {
+			BUISDevice *device;
+			bigtime_t start = system_time();
+			status_t status = roster.GetNextDevice(&device);
+			bigtime_t time = system_time() - start;
+
+			if (status == B_ENTRY_NOT_FOUND) {
+				empty = found == 0;
+				break;
+			}
+
+			samples[count++] = time;
+			if (status != B_OK) {
+				errors++;
+				break;
+			}
+			found++;
+			delete device;
+		}
+	}
+
+	print_result("GetNextDevice", samples, count, errors);
+}
+
+
+static void
+bench_find_item(bigtime_t *samples, int32 calls, BUISDevice *device,
+	BUISItem *item)
+{
+	int32 errors = 0;
+	for (int32 i = 0; i < calls; i++) {
+		bigtime_t start = system_time();
+		if (device->FindItem(item->UsagePage(), item->UsageId()) == NULL)
+			errors++;
+		samples[i] = system_time() - start;
+	}
+
+	print_result("FindItem", samples, calls, errors);
+}
+
+
+/*!	Items are cached by their report, so the round trip is only taken once
+	per item. The uncached case gets a new device for every call, outside of
+	the timed part.
+*/
+static void
+bench_item_at(bigtime_t *samples, int32 calls, BUISDevice *device)
+{
+	int32 count = 0, errors = 0;
+	for (int32 i = 0; i < calls; i++) {
+		BUISDevice *fresh = new BUISDevice(device->Device());
+		BUISReport *report = fresh->ReportAt(UIS_TYPE_INPUT, 0);
+		if (report == NULL || report->CountItems() == 0) {
+			delete fresh;
+			errors++;
+			continue;
+		}
+
+		bigtime_t start = system_time();
+		if (report->ItemAt(i % report->CountItems()) == NULL)
+			errors++;
+		samples[count++] = system_time() - start;
+		delete fresh;
+	}
+
+	print_result("ItemAt", samples, count, errors);
+
+	// too fast for system_time(), so it's timed in batches
+	BUISReport *report = device->ReportAt(UIS_TYPE_INPUT, 0);
+	int32 items = report->CountItems();
+	const int32 kBatch = 1000;
+	count = errors = 0;
+	for (int32 i = 0; i < calls / kBatch; i++) {
+		bigtime_t start = system_time();
+		for (int32 n = 0; n < kBatch; n++) {
+			if (report->ItemAt(n % items) == NULL)
+				errors++;
+		}
+		samples[count++] = system_time() - start;
+	}
+
+	if (count == 0) {
+		printf("%-22s skipped\n", "ItemAt (cached)");
+		return;
+	}
+
+	bigtime_t total = 0;
+	for (int32 i = 0; i < count; i++)
+		total += samples[i];
+	printf("%-22s %8.3f %8s %8s %8s %12.0f %7ld\n", "ItemAt (cached)",
+		(double) total / (count * kBatch), "-", "-", "-",
+		total > 0 ? count * kBatch * 1000000.0 / total : 0.0, errors);
+}
+
+
+static void
+bench_value(bigtime_t *samples, int32 calls, BUISItem *item)
+{
+	int32 errors = 0;
+	for (int32 i = 0; i < calls; i++) {
+		float value;
+		bigtime_t start = system_time();
+		if (item->Value(value) != B_OK)
+			errors++;
+		samples[i] = system_time() - start;
+	}
+
+	print_result("Value", samples, calls, errors);
+}
+
+
+static void
+bench_send(bigtime_t *samples, int32 calls, BUISDevice *device)
+{
+	uint8 type = UIS_TYPE_OUTPUT;
+	if (device->CountReports(type) <= 0)
+		type = UIS_TYPE_FEATURE;
+
+	BUISReport *report = device->ReportAt(type, 0);
+	if (report == NULL || report->CountItems() == 0) {
+		printf("%-22s skipped, the device has no output report\n", "Send");
+		return;
+	}
+
+	int32 errors = 0;
+	for (int32 i = 0; i < calls; i++) {
+		bigtime_t start = system_time();
+		if (report->SetItemValue(0, (i & 1) != 0 ? 1.0f : 0.0f) != B_OK
+			|| report->Send() != B_OK)
+			errors++;
+		samples[i] = system_time() - start;
+	}
+
+	print_result("Send", samples, calls, errors);
+}
+
+
+/*!	Counts the B_UIS_DEVICE_ADDED notifications of mock devices, to tell
+	when their bring-up is done. The input_server replies to
+	B_UIS_ADD_MOCK_DEVICES before that, as devices come up asynchronously.
+*/
+class BringUpWatcher : public BLooper {
+public:
+	BringUpWatcher(int32 expected)
+		:
+		BLooper("uisbench bring-up watcher"),
+		fExpected(expected),
+		fAdded(0),
+		fDoneTime(0),
+		fDone(create_sem(0, "uisbench bring-up"))
+	{
+	}
+
+	virtual ~BringUpWatcher()
+	{
+		delete_sem(fDone);
+	}
+
+	virtual void MessageReceived(BMessage *message)
+	{
+		int32 opcode;
+		const char *name;
+		if (message->what != B_UIS_DEVICE_EVENT
+			|| message->FindInt32("opcode", &opcode) != B_OK
+			|| opcode != B_UIS_DEVICE_ADDED
+			|| message->FindString("name", &name) != B_OK
+			|| strncmp(name, kMockName, sizeof(kMockName) - 1) != 0) {
+			BLooper::MessageReceived(message);
+			return;
+		}
+
+		if (++fAdded == fExpected) {
+			fDoneTime = system_time();
+			release_sem(fDone);
+		}
+	}
+
+	status_t Wait(bigtime_t timeout)
+	{
+		return acquire_sem_etc(fDone, 1, B_RELATIVE_TIMEOUT, timeout);
+	}
+
+	bigtime_t DoneTime() const { return fDoneTime; }
+
+private:
+	int32		fExpected;
+	int32		fAdded;
+	bigtime_t	fDoneTime;
+	sem_id		fDone;
+};
+
+
+static void
+remove_mock_devices()
+{
+	BMessage command(IS_UIS_MESSAGE), reply;
+	command.AddInt32("opcode", B_UIS_REMOVE_MOCK_DEVICES);
+	send_command(command, reply);
+}
+
+
+/*!	Adds the mock devices and waits until all of them are up, which is timed
+	from the request to the last notification.
+*/
+static status_t
+add_mock_devices(int32 count, BMessage &reply, bigtime_t *bringUpTime)
+{
+	BringUpWatcher *watcher = new BringUpWatcher(count);
+	watcher->Run();
+
+	BUISRoster roster;
+	status_t status = roster.StartWatching(watcher);
+	if (status == B_OK) {
+		BMessage command(IS_UIS_MESSAGE);
+		command.AddInt32("opcode", B_UIS_ADD_MOCK_DEVICES);
+		command.AddInt32("count", count);
+
+		bigtime_t start = system_time();
+		status = send_command(command, reply);
+		if (status == B_OK)
+			status = watcher->Wait(kBringUpTimeout);
+		if (status == B_OK)
+			*bringUpTime = watcher->DoneTime() - start;
+		roster.StopWatching();
+	}
+
+	watcher->Lock();
+	watcher->Quit();
+	return status;
+}
+
+
+struct stress_state {
+	BLooper *		looper;
+	volatile bool	running;
+	int32			lookups;
+	int32			targets;
+};
+
+
+static status_t
+stress_thread(void *data)
+{
+	stress_state *state = (stress_state *) data;
+	while (state->running) {
+		BUISRoster roster;
+		BUISDevice *device;
+		while (state->running && roster.GetNextDevice(&device) == B_OK) {
+			atomic_add(&state->lookups, 1);
+			BUISReport *report = device->ReportAt(UIS_TYPE_INPUT, 0);
+			BUISItem *item = report != NULL ? report->ItemAt(0) : NULL;
+			if (item != NULL) {
+				float value;
+				item->Value(value);
+				if (item->SetTarget(state->looper) == B_OK) {
+					atomic_add(&state->targets, 1);
+					item->SetTarget(NULL);
+				}
+			}
+			delete device;
+		}
+	}
+	return B_OK;
+}
+
+
+static int32
+count_mock_devices()
+{
+	int32 count = 0;
+	BUISRoster roster;
+	BUISDevice *device;
+	while (roster.GetNextDevice(&device) == B_OK) {
+		if (strncmp(device->Path(), kMockPathPrefix,
+				sizeof(kMockPathPrefix) - 1) == 0)
+			count++;
+		delete device;
+	}
+	return count;
+}
+
+
+/*!	Requests race with the bring-up and removal of devices here, errors of
+	single calls are expected. It fails if the input_server stops answering,
+	or if removed devices are still listed afterwards.
+*/
+static int
+stress(int32 seconds, int32 mockDevices, int32 threadCount)
+{
+	stress_state state;
+	state.looper = new BLooper("uisbench stress target");
+	state.looper->Run();
+	state.running = true;
+	state.lookups = 0;
+	state.targets = 0;
+
+	thread_id *threads = new thread_id[threadCount];
+	for (int32 i = 0; i < threadCount; i++) {
+		threads[i] = spawn_thread(stress_thread, "uisbench stress",
+			B_NORMAL_PRIORITY, &state);
+		resume_thread(threads[i]);
+	}
+
+	int32 rounds = 0, failures = 0;
+	bigtime_t end = system_time() + seconds * 1000000LL;
+	while (system_time() < end) {
+		BMessage command(IS_UIS_MESSAGE), reply;
+		command.AddInt32("opcode", B_UIS_ADD_MOCK_DEVICES);
+		command.AddInt32("count", mockDevices);
+		if (send_command(command, reply) != B_OK)
+			failures++;
+		snooze(20000 + rand() % 80000);
+
+		command.MakeEmpty();
+		command.AddInt32("opcode", B_UIS_REMOVE_MOCK_DEVICES);
+		if (send_command(command, reply) != B_OK)
+			failures++;
+		snooze(rand() % 50000);
+		rounds++;
+	}
+
+	state.running = false;
+	for (int32 i = 0; i < threadCount; i++) {
+		status_t result;
+		wait_for_thread(threads[i], &result);
+	}
+	delete[] threads;
+
+	// the readers remove the devices asynchronously
+	int32 leftover = count_mock_devices();
+	for (int32 i = 0; i < 50 && leftover > 0; i++) {
+		snooze(100000);
+		leftover = count_mock_devices();
+	}
+
+	state.looper->Lock();
+	state.looper->Quit();
+
+	printf("%ld rounds of %ld mock devices, %ld threads: %ld lookups, "
+		"%ld targets set, %ld failed requests, %ld devices left over\n",
+		rounds, mockDevices, threadCount, state.lookups, state.targets,
+		failures, leftover);
+	return failures == 0 && leftover == 0 ? 0 : 1;
+}
+
+
+static BUISDevice *
+lookup_device(const char *name, const char *path)
+{
+	if (name != NULL)
+		return BUISRoster::FindByName(name);
+
+	BUISRoster roster;
+	BUISDevice *device;
+	while (roster.GetNextDevice(&device) == B_OK) {
+		if (path != NULL ? strcmp(device->Path(), path) == 0
+				: device->CountReports(UIS_TYPE_INPUT) > 0)
+			return device;
+		delete device;
+	}
+
+	return NULL;
+}
+
+
+/*!	A device asked for by name or path may still be coming up, so it is
+	looked up again until kFindTimeout passed. Without either, the devices
+	that are there are all there is.
+*/
+static BUISDevice *
+find_device(const char *name, const char *path)
+{
+	bigtime_t deadline = system_time() + kFindTimeout;
+	while (true) {
+		BUISDevice *device = lookup_device(name, path);
+		if (device != NULL || (name == NULL && path == NULL)
+			|| system_time() >= deadline)
+			return device;
+		snooze(kFindInterval);
+	}
+}
+
+
+int
+main(int argc, char **argv)
+{
+	int32 calls = 10000;
+	int32 mockDevices = 0;
+	int32 stressSeconds = 0;
+	int32 threadCount = 8;
+	const char *name = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (argv[i][0] != '-' || i + 1 >= argc)
+			usage(argv[0]);
+
+		const char *value = argv[++i];
+		switch (argv[i - 1][1]) {
+			case 'n':
+				calls = atoi(value);
+				break;
+			case 'm':
+				mockDevices = atoi(value);
+				break;
+			case 'd':
+				name = value;
+				break;
+			case 's':
+				stressSeconds = atoi(value);
+				break;
+			case 't':
+				threadCount = atoi(value);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	if (calls < 1 || mockDevices < 0 || stressSeconds < 0 || threadCount < 1
+		|| (stressSeconds > 0 && mockDevices == 0))
+		usage(argv[0]);
+
+	if (stressSeconds > 0)
+		return stress(stressSeconds, mockDevices, threadCount);
+
+	BMessage mockReply;
+	const char *mockPath = NULL;
+	if (mockDevices > 0) {
+		bigtime_t bringUpTime;
+		status_t status = add_mock_devices(mockDevices, mockReply,
+			&bringUpTime);
+		if (status != B_OK) {
+			fprintf(stderr, "%s: adding mock devices failed: %s\n", argv[0],
+				strerror(status));
+			remove_mock_devices();
+			return 1;
+		}
+		mockReply.FindString("path", &mockPath);
+		printf("bring-up of %ld mock devices: %lld us\n", mockDevices,
+			bringUpTime);
+	}
+
+	bigtime_t *samples = (bigtime_t *) malloc(calls * sizeof(bigtime_t));
+	BUISDevice *device = find_device(name, mockPath);
+	BUISReport *report = device != NULL
+		? device->ReportAt(UIS_TYPE_INPUT, 0) : NULL;
+	BUISItem *item = report != NULL ? report->ItemAt(0) : NULL;
+
+	int result = 0;
+	if (samples == NULL) {
+		fprintf(stderr, "%s: out of memory\n", argv[0]);
+		result = 1;
+	} else if (item == NULL) {
+		fprintf(stderr, "%s: no device with an input report found\n",
+			argv[0]);
+		result = 1;
+	} else {
+		printf("device %ld \"%s\", %ld calls each\n", device->Device(),
+			device->Name(), calls);
+		print_header();
+		bench_get_next_device(samples, calls);
+		bench_find_item(samples, calls, device, item);
+		bench_item_at(samples, calls, device);
+		bench_value(samples, calls, item);
+		bench_send(samples, calls, device);
+	}
+
+	delete device;
+	free(samples);
+
+	if (mockDevices > 0)
+		remove_mock_devices();
+
+	return result;
+}
@@ -0,0 +1,115 @@
+#include <Message.h>
+
+#include <input_globals.h>
+#include <InputServerTypes.h>
+#include <UISProtocol.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static void
+usage(const char *program)
+{
+	fprintf(stderr, "usage: %s [-r] [<device id>]\n"
+		"Prints the latency histograms of the input path, for all devices\n"
+		"or the given one.\n"
+		"  -r  resets the histograms after printing them\n", program);
+	exit(1);
+}
+
+
+static const char *
+bucket_label(int32 bucket)
+{
+	static char label[32];
+	if (bucket == 0)
+		strcpy(label, "<= 1 us");
+	else if (bucket == B_UIS_LATENCY_BUCKETS - 1)
+		sprintf(label, ">= %lld us", 1LL << bucket);
+	else
+		sprintf(label, "%lld - %lld us", 1LL << bucket, (2LL << bucket) - 1);
+	return label;
+}
+
+
+static void
+print_histogram(const BMessage &message, const char *name,
+	const char *description)
+{
+	int32 counts[B_UIS_LATENCY_BUCKETS];
+	int32 total = 0;
+	for (int32 i = 0; i < B_UIS_LATENCY_BUCKETS; i++) {
+		if (message.FindInt32(name, i, &counts[i]) != B_OK)
+			return;
+		total += counts[i];
+	}
+
+	printf("  %s: %ld samples\n", description, total);
+	if (total == 0)
+		return;
+
+	int32 sum = 0;
+	for (int32 i = 0; i < B_UIS_LATENCY_BUCKETS; i++) {
+		if (counts[i] == 0)
+			continue;
+		sum += counts[i];
+		printf("    %-22s %10ld  %5.1f%%\n", bucket_label(i), counts[i],
+			100.0 * sum / total);
+	}
+}
+
+
+int
+main(int argc, char **argv)
+{
+	bool reset = false;
+	int32 device = -1;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-r") == 0)
+			reset = true;
+		else if (argv[i][0] != '-' && device < 0)
+			device = strtol(argv[i], NULL, 0);
+		else
+			usage(argv[0]);
+	}
+
+	BMessage command(IS_UIS_MESSAGE), reply;
+	command.AddInt32("opcode", B_UIS_GET_LATENCY);
+	if (device >= 0)
+		command.AddInt32("device", device);
+	if (reset)
+		command.AddBool("reset", true);
+
+	status_t status = _control_input_server_(&command, &reply);
+	if (status == B_OK && reply.FindInt32("status", &status) != B_OK)
+		status = B_ERROR;
+	if (status != B_OK) {
+		fprintf(stderr, "%s: could not get the latencies: %s\n", argv[0],
+			strerror(status));
+		return 1;
+	}
+
+	BMessage latency;
+	for (int32 i = 0; reply.FindMessage("devices", i, &latency) == B_OK;
+			i++) {
+		int32 id;
+		const char *name;
+		if (latency.FindInt32("device", &id) != B_OK)
+			continue;
+		if (latency.FindString("name", &name) != B_OK)
+			name = "";
+
+		printf("device 0x%lx \"%s\"\n", id, name);
+		print_histogram(latency, "driver", "report in -> ring buffer");
+		print_histogram(latency, "read", "ring buffer -> UIS_READ returned");
+		print_histogram(latency, "dispatch", "UIS_READ returned -> queued");
+	}
+
+	printf("all devices\n");
+	print_histogram(reply, "delivery", "queued -> message sent");
+	print_histogram(reply, "total", "report in -> message sent");
+	return 0;
+}
@@ -0,0 +1,113 @@
+#include <Message.h>
+#include <Path.h>
+
+#include <input_globals.h>
+#include <InputServerTypes.h>
+#include <UISProtocol.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static void
+usage(const char *program)
+{
+	fprintf(stderr, "usage: %s start <file>\n"
+		"       %s stop\n"
+		"       %s replay [-s <speed>] [-w] <file>\n"
+		"       %s stop-replay\n"
+		"Records the input reports of all devices, or replays a recording on\n"
+		"devices created from the recorded layouts.\n"
+		"  -s  replay speed, 2 is twice as fast as recorded, 0 as fast as\n"
+		"      possible (default 1)\n"
+		"  -w  wait for the replay to end and print its throughput\n",
+		program, program, program, program);
+	exit(1);
+}
+
+
+static status_t
+send_command(BMessage &command, BMessage &reply)
+{
+	status_t status = _control_input_server_(&command, &reply);
+	if (status == B_OK && reply.FindInt32("status", &status) != B_OK)
+		status = B_ERROR;
+	return status;
+}
+
+
+static bool
+add_path(BMessage &command, const char *program, const char *file)
+{
+	BPath path(file, NULL, true);
+		// the input_server opens the file, it needs an absolute path
+	if (path.InitCheck() != B_OK) {
+		fprintf(stderr, "%s: invalid path %s\n", program, file);
+		return false;
+	}
+
+	command.AddString("path", path.Path());
+	return true;
+}
+
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 2)
+		usage(argv[0]);
+
+	BMessage command(IS_UIS_MESSAGE), reply;
+	bool wait = false;
+
+	if (strcmp(argv[1], "start") == 0 && argc == 3) {
+		command.AddInt32("opcode", B_UIS_START_RECORDING);
+		if (!add_path(command, argv[0], argv[2]))
+			return 1;
+	} else if (strcmp(argv[1], "stop") == 0 && argc == 2) {
+		command.AddInt32("opcode", B_UIS_STOP_RECORDING);
+	} else if (strcmp(argv[1], "stop-replay") == 0 && argc == 2) {
+		command.AddInt32("opcode", B_UIS_STOP_REPLAY);
+	} else if (strcmp(argv[1], "replay") == 0) {
+		command.AddInt32("opcode", B_UIS_START_REPLAY);
+
+		const char *file = NULL;
+		for (int i = 2; i < argc; i++) {
+			if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+				command.AddFloat("speed", atof(argv[++i]));
+			else if (strcmp(argv[i], "-w") == 0)
+				wait = true;
+			else if (argv[i][0] != '-' && file == NULL)
+				file = argv[i];
+			else
+				usage(argv[0]);
+		}
+
+		if (file == NULL)
+			usage(argv[0]);
+		if (!add_path(command, argv[0], file))
+			return 1;
+		command.AddBool("wait", wait);
+	} else
+		usage(argv[0]);
+
+	status_t status = send_command(command, reply);
+	if (status != B_OK) {
+		fprintf(stderr, "%s: %s failed: %s\n", argv[0], argv[1],
+			strerror(status));
+		return 1;
+	}
+
+	int32 reports;
+	bigtime_t elapsed;
+	if (wait && reply.FindInt32("reports", &reports) == B_OK
+		&& reply.FindInt64("elapsed", &elapsed) == B_OK) {
+		printf("replayed %ld reports in %lld us", reports, elapsed);
+		if (elapsed > 0)
+			printf(", %.0f reports/s", reports * 1000000.0 / elapsed);
+		printf("\n");
+	}
+
+	return 0;
+}
@@ -0,0 +1,55 @@
+#include <Message.h>
+#include <Path.h>
+
+#include <input_globals.h>
+#include <InputServerTypes.h>
+#include <UISProtocol.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+int
+main(int argc, char **argv)
+{
+	if (argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+		fprintf(stderr, "usage: %s [<file>]\n"
+			"Writes the trace of the input path as Chrome trace event JSON,\n"
+			"to /var/log/uis_trace.json unless a file is given.\n", argv[0]);
+		return 1;
+	}
+
+	BMessage command(IS_UIS_MESSAGE), reply;
+	command.AddInt32("opcode", B_UIS_EXPORT_TRACE);
+	if (argc == 2) {
+		BPath path(argv[1], NULL, true);
+			// the input_server writes the file, it needs an absolute path
+		if (path.InitCheck() != B_OK) {
+			fprintf(stderr, "%s: invalid path %s\n", argv[0], argv[1]);
+			return 1;
+		}
+		command.AddString("path", path.Path());
+	}
+
+	status_t status = _control_input_server_(&command, &reply);
+	if (status == B_OK && reply.FindInt32("status", &status) != B_OK)
+		status = B_ERROR;
+	if (status != B_OK) {
+		fprintf(stderr, "%s: could not export the trace: %s\n", argv[0],
+			strerror(status));
+		return 1;
+	}
+
+	const char *path;
+	if (reply.FindString("path", &path) == B_OK)
+		printf("trace written to %s\n", path);
+
+	int32 threads, records;
+	if (reply.FindInt32("untraced threads", &threads) == B_OK && threads > 0
+		&& reply.FindInt32("lost records", &records) == B_OK) {
+		printf("trace is incomplete: %ld threads found no free ring, "
+			"%ld records lost\n", threads, records);
+	}
+	return 0;
+}
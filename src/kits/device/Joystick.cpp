@@ -13,6 +13,10 @@
 
 #define B_UIS_ITEM_EVENT '_UIE'
 
+// application usages of the generic desktop page
+static const uint16 kUsageJoystick = 0x04;
+static const uint16 kUsageGamePad = 0x05;
+
 
 class JoystickLooper : public BLooper
 {
@@ -98,24 +102,15 @@ BJoystick::BJoystick()
 	BUISRoster roster;
 	BUISDevice *device;
 
-	// joystick devices need to have at least: 2 axes (x & y) and 1 button
-	while (roster.GetNextDevice(&device) == B_OK) {
-		BUISItem* item = device->FindItem(HID_USAGE_PAGE_GENERIC_DESKTOP,
-			HID_USAGE_ID_X);
-		if (item != NULL) {
-			item = device->FindItem(HID_USAGE_PAGE_GENERIC_DESKTOP,
-				HID_USAGE_ID_Y);
-			if (item != NULL) {
-				item = device->FindItem(HID_USAGE_PAGE_BUTTON, 1);
-				if (item != NULL) {
-					fDevices->AddItem(device);
-					continue;
-				}
-			}
-		}
-		delete device;
-			// we're supposed to free device object if we don't use it
-	}
+	// joysticks and game pads, with at least 2 axes (x & y) and 1 button
+	roster.AddUsageFilter(HID_USAGE_PAGE_GENERIC_DESKTOP, kUsageJoystick);
+	roster.AddUsageFilter(HID_USAGE_PAGE_GENERIC_DESKTOP, kUsageGamePad);
+	roster.AddItemFilter(HID_USAGE_PAGE_GENERIC_DESKTOP, HID_USAGE_ID_X);
+	roster.AddItemFilter(HID_USAGE_PAGE_GENERIC_DESKTOP, HID_USAGE_ID_Y);
+	roster.AddItemFilter(HID_USAGE_PAGE_BUTTON, 1);
+
+	while (roster.GetNextDevice(&device) == B_OK)
+		fDevices->AddItem(device);
 
 	fLooper->Run();
 }
@@ -1,7 +1,10 @@
 #include <UISKit.h>
 
+#include <Autolock.h>
+#include <Locker.h>
 #include <Looper.h>
 #include <Message.h>
+#include <Messenger.h>
 
 #include <usb/USB_hid.h>
 
@@ -10,6 +13,7 @@
 #include <input_globals.h>
 #include <InputServerTypes.h>
 #include <AppMisc.h>
+#include <MessengerPrivate.h>
 
 #include <new>
 #include <stdlib.h>
@@ -20,6 +24,103 @@ using std::nothrow;
 using namespace BPrivate;
 
 
+static BLocker sUISServerLock("uis server");
+static port_id sUISServerPort = -1;
+static team_id sUISServerTeam = -1;
+static bool sUISServerPortKnown = false;
+	// also set when the input_server has no request port, so that not every
+	// request asks for it again
+
+
+static status_t
+_find_uis_server_port_()
+{
+	BMessage command(IS_UIS_MESSAGE), reply;
+
+	command.AddInt32("opcode", B_UIS_GET_SERVER_PORT);
+
+	status_t status = _control_input_server_(&command, &reply);
+	if (status != B_OK)
+		return status;
+
+	port_id port;
+	if (reply.FindInt32("port", (int32 *) &port) != B_OK)
+		return B_ERROR;
+
+	team_id team = -1;
+	if (port >= 0 && reply.FindInt32("team", (int32 *) &team) != B_OK)
+		return B_ERROR;
+
+	sUISServerPort = port;
+	sUISServerTeam = team;
+	sUISServerPortKnown = true;
+	return B_OK;
+}
+
+
+/*!	Forgets the request port, or that there is none, after a failed send, as
+	the input_server might have been restarted.
+*/
+static void
+_forget_uis_server_port_(port_id port)
+{
+	BAutolock lock(sUISServerLock);
+	if (sUISServerPort == port) {
+		sUISServerPort = -1;
+		sUISServerPortKnown = false;
+	}
+}
+
+
+static status_t
+_control_uis_input_server_(BMessage *command, BMessage *reply)
+{
+	status_t status = _control_input_server_(command, reply);
+	if (status != B_OK && !reply->HasInt32("status")) {
+		// not an error of the request, the message didn't get through
+		_forget_uis_server_port_(-1);
+	}
+	return status;
+}
+
+
+/*!	Sends a UIS request to the request port of the UIS manager, so that it
+	doesn't queue up behind other input_server traffic. Falls back to the
+	input_server looper if the port is not available.
+*/
+static status_t
+_control_uis_server_(BMessage *command, BMessage *reply)
+{
+	port_id port;
+	team_id team;
+	{
+		BAutolock lock(sUISServerLock);
+		if (!sUISServerPortKnown)
+			_find_uis_server_port_();
+		port = sUISServerPort;
+		team = sUISServerTeam;
+	}
+
+	if (port < 0)
+		return _control_uis_input_server_(command, reply);
+
+	BMessenger messenger;
+	BMessenger::Private(messenger).SetTo(team, port, B_PREFERRED_TOKEN);
+
+	status_t status = messenger.SendMessage(command, reply);
+	if (status == B_BAD_PORT_ID) {
+		_forget_uis_server_port_(port);
+		return _control_uis_input_server_(command, reply);
+	}
+	if (status != B_OK)
+		return status;
+
+	if (reply->FindInt32("status", &status) != B_OK)
+		return B_ERROR;
+	return status;
+}
+
+
 //	#pragma mark - BUISRoster
 
 
@@ -31,7 +132,7 @@ BUISRoster::FindByName(const char* name)
 	command.AddInt32("opcode", B_UIS_FIND_DEVICE);
 	command.AddString("name", name);
 
-	if (_control_input_server_(&command, &reply) != B_OK)
+	if (_control_uis_server_(&command, &reply) != B_OK)
 		return NULL;
 
 	uis_device_id deviceId;
@@ -47,17 +148,85 @@ BUISRoster::FindByName(const char* name)
 }
 
 
+struct BUISRoster::Data {
+	Data()
+		:
+		target(NULL),
+		filter(NULL),
+		devices(NULL),
+		deviceCount(0)
+	{
+	}
+
+	~Data()
+	{
+		delete filter;
+		delete [] devices;
+	}
+
+	void*			target;
+	BMessage*		filter;
+	uis_device_id*	devices;
+	int32			deviceCount;
+};
+
+
 BUISRoster::BUISRoster()
 	:
 	fCookie(0),
-	fTarget(NULL)
+	fData(new (std::nothrow) Data)
 {
 }
 
 
+BUISRoster::BUISRoster(uint16 usagePage, uint16 usageId)
+	:
+	fCookie(0),
+	fData(new (std::nothrow) Data)
+{
+	AddUsageFilter(usagePage, usageId);
+}
+
+
 BUISRoster::~BUISRoster()
 {
 	StopWatching();
+
+	delete fData;
+}
+
+
+status_t
+BUISRoster::AddUsageFilter(uint16 usagePage, uint16 usageId)
+{
+	BMessage* filter = _Filter();
+	if (filter == NULL)
+		return B_NO_MEMORY;
+
+	status_t status = filter->AddInt16("page", (int16) usagePage);
+	if (status == B_OK)
+		status = filter->AddInt16("id", (int16) usageId);
+
+	Rewind();
+	return status;
+}
+
+
+status_t
+BUISRoster::AddItemFilter(uint16 usagePage, uint16 usageId, uint8 type)
+{
+	BMessage* filter = _Filter();
+	if (filter == NULL)
+		return B_NO_MEMORY;
+
+	status_t status = filter->AddInt16("item page", (int16) usagePage);
+	if (status == B_OK)
+		status = filter->AddInt16("item id", (int16) usageId);
+	if (status == B_OK)
+		status = filter->AddInt8("item type", (int8) type);
+
+	Rewind();
+	return status;
 }
 
 
@@ -66,30 +235,28 @@ BUISRoster::GetNextDevice(BUISDevice** device)
 {
 	if (device == NULL)
 		return B_BAD_VALUE;
+	if (fData == NULL)
+		return B_NO_MEMORY;
 
-	BMessage command(IS_UIS_MESSAGE), reply;
-
-	command.AddInt32("opcode", B_UIS_NEXT_DEVICE);
-	command.AddInt32("device", fCookie);
+	if (fData->devices == NULL) {
+		status_t status = _FetchDevices();
+		if (status != B_OK)
+			return status;
+	}
 
-	status_t status = _control_input_server_(&command, &reply);
-	if (status != B_OK)
-		return status;
+	while (fCookie < fData->deviceCount) {
+		*device = new (std::nothrow) BUISDevice(fData->devices[fCookie++]);
+		if (*device == NULL)
+			return B_NO_MEMORY;
+		if ((*device)->InitCheck() == B_OK)
+			return B_OK;
 
-	uis_device_id next;
-	status = reply.FindInt32("next", &next);
-	if (status != B_OK)
-		return status;
-
-	*device = new (std::nothrow) BUISDevice(next);
-	if (*device == NULL)
-		return B_ERROR;
-	status = (*device)->InitCheck();
-	if (status != B_OK)
-		return status;
+		delete *device;
+			// removed since we got the list
+	}
 
-	fCookie = next;
-	return B_OK;
+	*device = NULL;
+	return B_ENTRY_NOT_FOUND;
 }
 
 
@@ -97,19 +264,97 @@ void
 BUISRoster::Rewind()
 {
 	fCookie = 0;
+	if (fData == NULL)
+		return;
+
+	delete [] fData->devices;
+	fData->devices = NULL;
+	fData->deviceCount = 0;
 }
 
 
+BMessage*
+BUISRoster::_Filter()
+{
+	if (fData == NULL)
+		return NULL;
+
+	if (fData->filter == NULL)
+		fData->filter = new (std::nothrow) BMessage(IS_UIS_MESSAGE);
+	return fData->filter;
+}
+
+
+/*!	Gets the ids of all devices matching the filter with a single request,
+	the filter is evaluated by the input_server.
+*/
 status_t
-BUISRoster::StartWatching(BLooper* looper)
+BUISRoster::_FetchDevices()
 {
+	BMessage command(IS_UIS_MESSAGE), reply;
+	if (fData->filter != NULL)
+		command = *fData->filter;
+
+	command.AddInt32("opcode", B_UIS_FIND_DEVICES);
+
+	status_t status = _control_uis_server_(&command, &reply);
+	if (status != B_OK)
+		return status;
+
+	int32 count = 0;
+	reply.GetInfo("device", NULL, &count);
+
+	fData->devices = new (std::nothrow) uis_device_id[count];
+	if (fData->devices == NULL)
+		return B_NO_MEMORY;
+
+	for (int32 i = 0; i < count; i++) {
+		if (reply.FindInt32("device", i,
+				&fData->devices[fData->deviceCount]) == B_OK)
+			fData->deviceCount++;
+	}
+
 	return B_OK;
 }
 
 
+status_t
+BUISRoster::StartWatching(BLooper* looper)
+{
+	if (looper == NULL)
+		return B_BAD_VALUE;
+	if (fData == NULL)
+		return B_NO_MEMORY;
+
+	StopWatching();
+
+	BMessage command(IS_UIS_MESSAGE), reply;
+
+	command.AddInt32("opcode", B_UIS_START_WATCHING);
+	command.AddInt32("team id", (int32) looper->Team());
+	command.AddInt32("looper port", (int32) _get_looper_port_(looper));
+	command.AddInt32("object token", _get_object_token_(looper));
+
+	status_t status = _control_uis_server_(&command, &reply);
+	if (status != B_OK)
+		return status;
+	return reply.FindPointer("target", &fData->target);
+}
+
+
 void
 BUISRoster::StopWatching()
 {
+	if (fData == NULL || fData->target == NULL)
+		return;
+
+	BMessage command(IS_UIS_MESSAGE), reply;
+
+	command.AddInt32("opcode", B_UIS_STOP_WATCHING);
+	command.AddPointer("target", fData->target);
+
+	_control_uis_server_(&command, &reply);
+	fData->target = NULL;
 }
 
 
@@ -134,7 +379,7 @@ BUISDevice::BUISDevice(uis_device_id device)
 	command.AddInt32("opcode", B_UIS_GET_DEVICE);
 	command.AddInt32("device", device);
 
-	if (_control_input_server_(&command, &reply) != B_OK)
+	if (_control_uis_server_(&command, &reply) != B_OK)
 		return;
 
 	const char *name, *path;
@@ -191,7 +436,7 @@ BUISDevice::ReportAt(uint8 type, int32 index)
 	command.AddInt32("report", index);
 	command.AddInt8("type", (int8) type);
 
-	if (_control_input_server_(&command, &reply) != B_OK)
+	if (_control_uis_server_(&command, &reply) != B_OK)
 		return NULL;
 
 	int32 items;
@@ -224,7 +469,7 @@ BUISDevice::FindItem(uint16 usagePage, uint16 usageId, uint8 type)
 	command.AddInt16("page", (int16) usagePage);
 	command.AddInt16("id", (int16) usageId);
 
-	if (_control_input_server_(&command, &reply) != B_OK)
+	if (_control_uis_server_(&command, &reply) != B_OK)
 		return NULL;
 
 	int32 reportIndex, itemIndex;
@@ -278,7 +523,7 @@ BUISReport::ItemAt(int32 index)
 	command.AddInt32("report", fIndex);
 	command.AddInt32("item", index);
 
-	if (_control_input_server_(&command, &reply) != B_OK)
+	if (_control_uis_server_(&command, &reply) != B_OK)
 		return NULL;
 
 	uint16 page, id;
@@ -355,7 +600,7 @@ BUISReport::Send()
 
 	BMessage reply;
 
-	status_t status = _control_input_server_(fSendMessage, &reply);
+	status_t status = _control_uis_server_(fSendMessage, &reply);
 	if (status == B_OK)
 		MakeEmpty();
 	return status;
@@ -404,7 +649,7 @@ BUISItem::Value(float& value)
 	command.AddInt32("report", fReport->Index());
 	command.AddInt32("item", fIndex);
 
-	status_t status = _control_input_server_(&command, &reply);
+	status_t status = _control_uis_server_(&command, &reply);
 	if (status != B_OK)
 		return status;
 	return reply.FindFloat("value", &value);
@@ -427,6 +672,14 @@ BUISItem::SetTarget(BLooper* looper)
 
 status_t
 BUISItem::SetTarget(BLooper* looper, void* cookie)
+{
+	return SetTarget(looper, cookie, 0.0f, 0.0f);
+}
+
+
+status_t
+BUISItem::SetTarget(BLooper* looper, void* cookie, float minimumDelta,
+	float maximumRate)
 {
 	BMessage command(IS_UIS_MESSAGE), reply;
 
@@ -441,11 +694,52 @@ BUISItem::SetTarget(BLooper* looper, void* cookie)
 		command.AddInt32("looper port", (int32) _get_looper_port_(looper));
 		command.AddInt32("object token", _get_object_token_(looper));
 		command.AddPointer("cookie", cookie);
+		if (minimumDelta > 0.0f)
+			command.AddFloat("minimum delta", minimumDelta);
+		if (maximumRate > 0.0f)
+			command.AddFloat("maximum rate", maximumRate);
 	}
 
 	command.AddPointer("target", fTarget);
-	status_t status = _control_input_server_(&command, &reply);
+	status_t status = _control_uis_server_(&command, &reply);
 	if (status != B_OK)
 		return status;
 	return reply.FindPointer("target", &fTarget);
 }
+
+
+status_t
+BUISItem::SetFilter(float deadzone, float hysteresis)
+{
+	BMessage command(IS_UIS_MESSAGE), reply;
+
+	command.AddInt32("opcode", B_UIS_ITEM_SET_FILTER);
+	command.AddInt32("device", fReport->Device()->Device());
+	command.AddInt8("type", (int8) Type());
+	command.AddInt32("report", fReport->Index());
+	command.AddInt32("item", fIndex);
+	command.AddFloat("deadzone", deadzone);
+	command.AddFloat("hysteresis", hysteresis);
+
+	return _control_uis_server_(&command, &reply);
+}
+
+
+status_t
+BUISItem::GetFilter(float& deadzone, float& hysteresis)
+{
+	BMessage command(IS_UIS_MESSAGE), reply;
+
+	command.AddInt32("opcode", B_UIS_ITEM_GET_FILTER);
+	command.AddInt32("device", fReport->Device()->Device());
+	command.AddInt8("type", (int8) Type());
+	command.AddInt32("report", fReport->Index());
+	command.AddInt32("item", fIndex);
+
+	status_t status = _control_uis_server_(&command, &reply);
+	if (status == B_OK)
+		status = reply.FindFloat("deadzone", &deadzone);
+	if (status == B_OK)
+		status = reply.FindFloat("hysteresis", &hysteresis);
+	return status;
+}
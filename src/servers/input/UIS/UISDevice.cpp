@@ -1,9 +1,13 @@
 #include "UISDevice.h"
 #include "UISManager.h"
 #include "UISReport.h"
+#include "UISItem.h"
+#include "UISDeviceIO.h"
 
+#include <Autolock.h>
 #include <UISProtocol.h>
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <new>
@@ -13,16 +17,59 @@ using std::nothrow;
 #include "UIS_debug.h"
 
 
+static const size_t kInitialLayoutSize = 4096;
+
+
+/*!	Checks that the report and item counts of a layout stay within it, so
+	that a broken driver or recording can't make _InitReports() read past
+	the end of the buffer.
+*/
+static bool
+layout_is_valid(const uis_layout_info *layout, size_t bufferSize)
+{
+	if (layout->size < sizeof(uis_layout_info) || layout->size > bufferSize
+		|| layout->itemCount < 0)
+		return false;
+
+	uint64 reportCount = 0;
+	for (uint8 type = 0; type < UIS_REPORT_TYPES; type++) {
+		if (layout->reportCount[type] < 0)
+			return false;
+		reportCount += layout->reportCount[type];
+	}
+
+	if (sizeof(uis_layout_info) + reportCount * sizeof(uis_report_layout)
+			+ (uint64) layout->itemCount * sizeof(uis_item_layout)
+			> layout->size)
+		return false;
+
+	const uis_report_layout *reports
+		= (const uis_report_layout *) (layout + 1);
+	for (uint64 i = 0; i < reportCount; i++) {
+		if (reports[i].itemCount < 0 || reports[i].firstItem < 0
+			|| reports[i].firstItem > layout->itemCount - reports[i].itemCount)
+			return false;
+	}
+
+	return true;
+}
+
+
 UISDevice::UISDevice(uis_device_id id, UISManager *manager, const char *path)
 	:
 	fStatus(B_NO_INIT),
+	fRefCount(1),
 	fDeviceId(id),
 	fUISManager(manager),
 	fPath(strdup(path)),
 	fDevice(-1),
 	fUsagePage(0),
-	fUsageId(0)
+	fUsageId(0),
+	fVendorId(0),
+	fProductId(0),
+	fStatsLock("uis device stats")
 {
+	memset(&fDeviceStatsBase, 0, sizeof(fDeviceStatsBase));
 	fReports[UIS_REPORT_TYPE_INPUT] = NULL;
 	fReports[UIS_REPORT_TYPE_OUTPUT] = NULL;
 	fReports[UIS_REPORT_TYPE_FEATURE] = NULL;
@@ -32,29 +79,178 @@ UISDevice::UISDevice(uis_device_id id, UISManager *manager, const char *path)
 
 	TRACE("create device at %s\n", path);
 
-	fDevice = open(fPath, O_RDWR);
+	fDevice = uis_open(fPath, O_RDWR);
 	if (fDevice == -1)
 		return;
 
-	uis_device_info info;
-	fStatus = ioctl(fDevice, UIS_DEVICE_INFO, &info);
-	if (fStatus != B_OK)
+	fStatus = _InitFromLayout();
+	if (fStatus == B_DEV_INVALID_IOCTL || fStatus == B_BAD_DATA)
+		fStatus = _InitFromInfo();
+			// driver doesn't know about layouts, or got it wrong, ask item
+			// by item
+}
+
+
+/*!	Creates a device that has no driver behind it, from a layout recorded
+	by UISRecorder. Its reports get their data from UISReplayer.
+*/
+UISDevice::UISDevice(uis_device_id id, UISManager *manager, const char *path,
+	const char *name, const uis_layout_info *layout)
+	:
+	fStatus(B_NO_INIT),
+	fRefCount(1),
+	fDeviceId(id),
+	fUISManager(manager),
+	fPath(strdup(path)),
+	fDevice(-1),
+	fUsagePage(layout->usage.page),
+	fUsageId(layout->usage.id),
+	fVendorId(0),
+	fProductId(0),
+		// the USB ids are left out, so filters set on a replayed device
+		// are never saved for the real one
+	fStatsLock("uis device stats")
+{
+	memset(&fDeviceStatsBase, 0, sizeof(fDeviceStatsBase));
+	fReports[UIS_REPORT_TYPE_INPUT] = NULL;
+	fReports[UIS_REPORT_TYPE_OUTPUT] = NULL;
+	fReports[UIS_REPORT_TYPE_FEATURE] = NULL;
+	fReportsCount[UIS_REPORT_TYPE_INPUT] = 0;
+	fReportsCount[UIS_REPORT_TYPE_OUTPUT] = 0;
+	fReportsCount[UIS_REPORT_TYPE_FEATURE] = 0;
+
+	TRACE("create replayed device %s\n", path);
+
+	if (fPath == NULL)
+		return;
+	if (!layout_is_valid(layout, layout->size)) {
+		fStatus = B_BAD_DATA;
 		return;
+	}
 
-	fUsagePage = info.usage.page;
-	fUsageId = info.usage.id;
-	fName.SetTo(fDevice, info.name);
-	//TRACE("usage: %08x, input report count: %d, name: %d\n", fUsage,
-	//	info.reportCount, info.name);
+	fName.SetTo(name);
+	_InitReports(layout);
+	fStatus = B_OK;
+}
+
+
+UISDevice::~UISDevice()
+{
+	TRACE("delete device at: %s\n", fPath);
 
 	for (uint8 type = 0; type < UIS_REPORT_TYPES; type ++) {
-		fReports[type] = new (std::nothrow) UISReport *[info.reportCount[type]];
+		for (int32 n = 0; n < fReportsCount[type]; n++)
+			delete fReports[type][n];
+		delete [] fReports[type];
+	}
+
+	if (fDevice != -1) {
+		uis_close(fDevice);
+		fDevice = -1;
+	}
+
+	free(fPath);
+}
+
+
+void
+UISDevice::AcquireReference()
+{
+	atomic_add(&fRefCount, 1);
+}
+
+
+void
+UISDevice::ReleaseReference()
+{
+	if (atomic_add(&fRefCount, -1) == 1)
+		delete this;
+}
+
+
+/*!	Starts the readers of all reports, once the device has been added to
+	the manager.
+*/
+status_t
+UISDevice::StartReading()
+{
+	for (uint8 type = 0; type < UIS_REPORT_TYPES; type++) {
+		for (int32 n = 0; n < fReportsCount[type]; n++) {
+			status_t status = fReports[type][n]->StartReading();
+			if (status != B_OK)
+				return status;
+		}
+	}
+	return B_OK;
+}
+
+
+/*!	Gets the layout of all reports and items with a single ioctl, so that
+	opening a device doesn't cost an ioctl per report and item.
+*/
+status_t
+UISDevice::_InitFromLayout()
+{
+	size_t size = kInitialLayoutSize;
+	uis_layout_info *layout = NULL;
+
+	while (true) {
+		uis_layout_info *newLayout = (uis_layout_info *) realloc(layout, size);
+		if (newLayout == NULL) {
+			free(layout);
+			return B_NO_MEMORY;
+		}
+		layout = newLayout;
+
+		layout->size = size;
+		if (uis_ioctl(fDevice, UIS_LAYOUT_INFO, layout, size) == 0)
+			break;
+		status_t status = errno;
+		if (status != B_BUFFER_OVERFLOW || layout->size <= size) {
+			free(layout);
+			return status;
+		}
+		size = layout->size;
+	}
+
+	if (!layout_is_valid(layout, size)) {
+		TRACE("inconsistent layout of %s\n", fPath);
+		free(layout);
+		return B_BAD_DATA;
+	}
+
+	fUsagePage = layout->usage.page;
+	fUsageId = layout->usage.id;
+	fVendorId = layout->vendor;
+	fProductId = layout->product;
+	fName.SetTo(fDevice, layout->name);
+	_InitReports(layout);
+
+	free(layout);
+	return B_OK;
+}
+
+
+void
+UISDevice::_InitReports(const uis_layout_info *layout)
+{
+	const uis_report_layout *reports
+		= (const uis_report_layout *) (layout + 1);
+	int32 reportCount = 0;
+	for (uint8 type = 0; type < UIS_REPORT_TYPES; type++)
+		reportCount += layout->reportCount[type];
+	const uis_item_layout *items
+		= (const uis_item_layout *) (reports + reportCount);
+
+	for (uint8 type = 0; type < UIS_REPORT_TYPES; type++) {
+		fReports[type]
+			= new (std::nothrow) UISReport *[layout->reportCount[type]];
 		if (fReports[type] == NULL)
-			return;
+			break;
 
-		for (int32 i = 0; i < info.reportCount[type]; i++) {
+		for (int32 i = 0; i < layout->reportCount[type]; i++) {
 			UISReport *report = new (std::nothrow) UISReport(fDevice, this,
-				type, i);
+				i, &reports[i], items + reports[i].firstItem);
 			if (report == NULL)
 				break;
 			if (report->InitCheck() != B_OK) {
@@ -63,26 +259,44 @@ UISDevice::UISDevice(uis_device_id id, UISManager *manager, const char *path)
 			}
 			fReports[type][fReportsCount[type]++] = report;
 		}
+		reports += layout->reportCount[type];
 	}
 }
 
 
-UISDevice::~UISDevice()
+status_t
+UISDevice::_InitFromInfo()
 {
-	TRACE("delete device at: %s\n", fPath);
+	uis_device_info info;
+	status_t status = uis_ioctl(fDevice, UIS_DEVICE_INFO, &info);
+	if (status != B_OK)
+		return status;
+
+	fUsagePage = info.usage.page;
+	fUsageId = info.usage.id;
+	fName.SetTo(fDevice, info.name);
+	//TRACE("usage: %08x, input report count: %d, name: %d\n", fUsage,
+	//	info.reportCount, info.name);
 
 	for (uint8 type = 0; type < UIS_REPORT_TYPES; type ++) {
-		for (int32 n = 0; n < fReportsCount[type]; n++)
-			delete fReports[type][n];
-		delete [] fReports[type];
-	}
+		fReports[type] = new (std::nothrow) UISReport *[info.reportCount[type]];
+		if (fReports[type] == NULL)
+			break;
 
-	if (fDevice != -1) {
-		close(fDevice);
-		fDevice = -1;
+		for (int32 i = 0; i < info.reportCount[type]; i++) {
+			UISReport *report = new (std::nothrow) UISReport(fDevice, this,
+				type, i);
+			if (report == NULL)
+				break;
+			if (report->InitCheck() != B_OK) {
+				delete report;
+				break;
+			}
+			fReports[type][fReportsCount[type]++] = report;
+		}
 	}
 
-	free(fPath);
+	return B_OK;
 }
 
 
@@ -119,8 +333,79 @@ UISDevice::ReportAt(uint8 type, int32 index)
 }
 
 
+bool
+UISDevice::FindItem(uint8 type, uint16 usagePage, uint16 usageId,
+	int32 *reportIndex, int32 *itemIndex)
+{
+	for (int32 ir = 0; ir < CountReports(type); ir++) {
+		UISReport *report = fReports[type][ir];
+		for (int32 ii = 0; ii < report->CountItems(); ii++) {
+			UISReportItem *item = report->ItemAt(ii);
+			if (item->UsagePage() == usagePage && item->UsageId() == usageId) {
+				if (reportIndex != NULL)
+					*reportIndex = ir;
+				if (itemIndex != NULL)
+					*itemIndex = ii;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+
+/*!	Returns the counters of the driver, summing up those of the input
+	reports.
+*/
+status_t
+UISDevice::GetStats(uis_stats_info *stats, bool reset)
+{
+	uis_stats_info info;
+	info.report = NULL;
+	info.reset = false;
+	if (uis_ioctl(fDevice, UIS_GET_STATS, &info) != 0)
+		return errno;
+
+	stats->report = NULL;
+	stats->reset = reset;
+	stats->interface = info.interface;
+	memset(&stats->reports, 0, sizeof(stats->reports));
+
+	{
+		BAutolock lock(fStatsLock);
+		stats->device.transfers
+			= info.device.transfers - fDeviceStatsBase.transfers;
+		stats->device.transferErrors
+			= info.device.transferErrors - fDeviceStatsBase.transferErrors;
+		stats->device.stalls = info.device.stalls - fDeviceStatsBase.stalls;
+		stats->device.shortReports
+			= info.device.shortReports - fDeviceStatsBase.shortReports;
+		if (reset)
+			fDeviceStatsBase = info.device;
+	}
+
+	// the report counters are ours alone
+	info.reset = reset;
+	for (int32 i = 0; i < CountReports(UIS_REPORT_TYPE_INPUT); i++) {
+		info.report = ReportAt(UIS_REPORT_TYPE_INPUT, i)->Report();
+		if (uis_ioctl(fDevice, UIS_GET_STATS, &info) != 0)
+			return errno;
+
+		stats->reports.wakeups += info.reports.wakeups;
+		stats->reports.interruptedWakeups += info.reports.interruptedWakeups;
+		stats->reports.reports += info.reports.reports;
+		stats->reports.records += info.reports.records;
+		stats->reports.ringOverflows += info.reports.ringOverflows;
+		stats->reports.missedReports += info.reports.missedReports;
+	}
+
+	return B_OK;
+}
+
+
 void
 UISDevice::Remove()
 {
-	fUISManager->RemoveDevice(fDeviceId);
+	fUISManager->RemoveDevice(fDeviceId, this);
 }
@@ -1,9 +1,11 @@
 #ifndef _UIS_DEVICE_H
 #define _UIS_DEVICE_H
 
+#include <Locker.h>
 #include <uis_driver.h>
 #include <UISKit.h>
 
+#include "UISLatency.h"
 #include "UISString.h"
 
 
@@ -14,10 +16,18 @@ class UISDevice {
 public:
 					UISDevice(uis_device_id id, UISManager *manager,
 						const char *path);
+					UISDevice(uis_device_id id, UISManager *manager,
+						const char *path, const char *name,
+						const uis_layout_info *layout);
 					~UISDevice();
 
 	status_t		InitCheck() { return fStatus; };
+	status_t		StartReading();
+
+	void			AcquireReference();
+	void			ReleaseReference();
 
+	uis_device_id	Id() { return fDeviceId; };
 	UISManager *	Manager() { return fUISManager; };
 	bool			HasPath(const char *path);
 	bool			HasName(const char *name);
@@ -26,13 +36,27 @@ public:
 	const char *	Name() { return fName.String(); };
 	uint16			UsagePage() { return fUsagePage; };
 	uint16			UsageId() { return fUsageId; };
+	uint16			VendorId() { return fVendorId; };
+	uint16			ProductId() { return fProductId; };
 	int32			CountReports(uint8 type);
 	UISReport *		ReportAt(uint8 type, int32 index);
+	bool			FindItem(uint8 type, uint16 usagePage, uint16 usageId,
+						int32 *reportIndex = NULL, int32 *itemIndex = NULL);
+	status_t		GetStats(uis_stats_info *stats, bool reset);
+
+	UISLatencyHistogram &	DriverLatency() { return fDriverLatency; };
+	UISLatencyHistogram &	ReadLatency() { return fReadLatency; };
+	UISLatencyHistogram &	DispatchLatency() { return fDispatchLatency; };
 
 	void			Remove();
 
 private:
+	status_t		_InitFromLayout();
+	void			_InitReports(const uis_layout_info *layout);
+	status_t		_InitFromInfo();
+
 	status_t		fStatus;
+	int32			fRefCount;
 	uis_device_id	fDeviceId;
 	UISManager *	fUISManager;
 	char *			fPath;
@@ -40,8 +64,22 @@ private:
 	UISString		fName;
 	uint16			fUsagePage;
 	uint16			fUsageId;
+	uint16			fVendorId;
+	uint16			fProductId;
 	UISReport **	fReports[UIS_REPORT_TYPES];
 	int32			fReportsCount[UIS_REPORT_TYPES];
+
+	BLocker			fStatsLock;
+	uis_device_stats	fDeviceStatsBase;
+		// the counters of the interface are shared with the other devices
+		// on it, so they are reset against this rather than in the driver
+
+	UISLatencyHistogram	fDriverLatency;
+		// report came in -> record written to the ring buffer
+	UISLatencyHistogram	fReadLatency;
+		// record written -> UIS_READ returned
+	UISLatencyHistogram	fDispatchLatency;
+		// UIS_READ returned -> events of all items queued
 };
 
 #endif // _UIS_DEVICE_H
@@ -0,0 +1,51 @@
+#ifndef _UIS_DEVICE_IO_H
+#define _UIS_DEVICE_IO_H
+
+#include <SupportDefs.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef UIS_MOCK_DEVICES
+#include <uis_mock_device.h>
+#endif
+
+
+// All device access of the UIS goes through these, so that builds with
+// UIS_MOCK_DEVICES serve the mock devices of uis_mock_device.h next to the
+// real ones.
+
+static inline int
+uis_open(const char *path, int mode)
+{
+#ifdef UIS_MOCK_DEVICES
+	return uis_mock_open(path, mode);
+#else
+	return open(path, mode);
+#endif
+}
+
+
+static inline int
+uis_close(int fd)
+{
+#ifdef UIS_MOCK_DEVICES
+	return uis_mock_close(fd);
+#else
+	return close(fd);
+#endif
+}
+
+
+static inline int
+uis_ioctl(int fd, uint32 op, void *buffer, size_t length = 0)
+{
+#ifdef UIS_MOCK_DEVICES
+	return uis_mock_ioctl(fd, op, buffer, length);
+#else
+	return ioctl(fd, op, buffer, length);
+#endif
+}
+
+
+#endif // _UIS_DEVICE_IO_H
@@ -0,0 +1,105 @@
+#include "UISDeviceIdAllocator.h"
+
+#include <string.h>
+#include <new>
+
+using std::nothrow;
+
+
+// A device id is made of a slot number and the generation of that slot.
+// The generation is bumped each time a slot is freed, so that a client
+// holding the id of a removed device doesn't end up talking to another
+// device that happens to get the same slot later. Slots are recycled in
+// FIFO order which keeps reuse of any single slot as rare as possible.
+// Slot 0 is never used, so valid ids are always greater than 0 and ids
+// are ordered the same way as their slots.
+
+static const int32 kGenerationBits = 8;
+static const int32 kGenerationMask = (1 << kGenerationBits) - 1;
+static const int32 kMaxSlots = 0x7fffffff >> kGenerationBits;
+static const int32 kInitialSlots = 32;
+
+
+UISDeviceIdAllocator::UISDeviceIdAllocator()
+	:
+	fGenerations(NULL),
+	fSlotCount(0),
+	fFreeSlots(NULL),
+	fFreeHead(0),
+	fFreeCount(0)
+{
+}
+
+
+UISDeviceIdAllocator::~UISDeviceIdAllocator()
+{
+	delete [] fGenerations;
+	delete [] fFreeSlots;
+}
+
+
+uis_device_id
+UISDeviceIdAllocator::Allocate()
+{
+	if (fFreeCount == 0 && _Grow() != B_OK)
+		return B_NO_MEMORY;
+
+	int32 slot = fFreeSlots[fFreeHead];
+	fFreeHead = (fFreeHead + 1) % fSlotCount;
+	fFreeCount--;
+
+	return (slot << kGenerationBits) | fGenerations[slot];
+}
+
+
+void
+UISDeviceIdAllocator::Free(uis_device_id id)
+{
+	int32 slot = id >> kGenerationBits;
+	if (id <= 0 || slot >= fSlotCount
+			|| fGenerations[slot] != (id & kGenerationMask))
+		return;
+			// not one of ours, or freed already
+
+	fGenerations[slot] = (fGenerations[slot] + 1) & kGenerationMask;
+	fFreeSlots[(fFreeHead + fFreeCount) % fSlotCount] = slot;
+	fFreeCount++;
+}
+
+
+status_t
+UISDeviceIdAllocator::_Grow()
+{
+	int32 count = (fSlotCount == 0) ? kInitialSlots : fSlotCount * 2;
+	if (count > kMaxSlots)
+		count = kMaxSlots;
+	if (count <= fSlotCount)
+		return B_NO_MEMORY;
+
+	uint8 *generations = new (std::nothrow) uint8[count];
+	int32 *freeSlots = new (std::nothrow) int32[count];
+	if (generations == NULL || freeSlots == NULL) {
+		delete [] generations;
+		delete [] freeSlots;
+		return B_NO_MEMORY;
+	}
+
+	memset(generations, 0, count);
+	if (fSlotCount > 0)
+		memcpy(generations, fGenerations, fSlotCount);
+
+	// the free queue is empty when growing, so it only holds the new slots
+	int32 first = (fSlotCount == 0) ? 1 : fSlotCount;
+	fFreeCount = 0;
+	for (int32 slot = first; slot < count; slot++)
+		freeSlots[fFreeCount++] = slot;
+	fFreeHead = 0;
+
+	delete [] fGenerations;
+	delete [] fFreeSlots;
+	fGenerations = generations;
+	fFreeSlots = freeSlots;
+	fSlotCount = count;
+
+	return B_OK;
+}
@@ -0,0 +1,26 @@
+#ifndef _UIS_DEVICE_ID_ALLOCATOR_H
+#define _UIS_DEVICE_ID_ALLOCATOR_H
+
+#include <UISKit.h>
+
+
+class UISDeviceIdAllocator {
+public:
+						UISDeviceIdAllocator();
+						~UISDeviceIdAllocator();
+
+	uis_device_id		Allocate();
+	void				Free(uis_device_id id);
+
+private:
+	status_t			_Grow();
+
+	uint8 *				fGenerations;
+	int32				fSlotCount;
+	int32 *				fFreeSlots;
+	int32				fFreeHead;
+	int32				fFreeCount;
+};
+
+
+#endif // _UIS_DEVICE_ID_ALLOCATOR_H
@@ -0,0 +1,179 @@
+#include "UISFilterSettings.h"
+
+#include <Autolock.h>
+#include <FindDirectory.h>
+#include <Path.h>
+#include <driver_settings.h>
+
+#include <uis_driver.h>
+
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "UIS_debug.h"
+
+
+struct saved_filter {
+	uint16	vendorId;
+	uint16	productId;
+	uint8	reportId;
+	int32	index;
+	float	deadzone;
+	float	hysteresis;
+};
+
+
+UISFilterSettings::UISFilterSettings()
+	:
+	fLock("uis filter settings")
+{
+}
+
+
+UISFilterSettings::~UISFilterSettings()
+{
+	_MakeEmpty();
+}
+
+
+void
+UISFilterSettings::Load()
+{
+	BAutolock _(fLock);
+	_MakeEmpty();
+
+	void *handle = load_driver_settings(USB_HID_FILTER_SETTINGS);
+	if (handle == NULL)
+		return;
+
+	const driver_settings *settings = get_driver_settings(handle);
+	for (int i = 0; settings != NULL && i < settings->parameter_count; i++) {
+		const driver_parameter *device = &settings->parameters[i];
+		if (strcmp(device->name, "device") != 0 || device->value_count < 2)
+			continue;
+
+		for (int j = 0; j < device->parameter_count; j++) {
+			const driver_parameter *parameter = &device->parameters[j];
+			if (strcmp(parameter->name, "filter") != 0
+				|| parameter->value_count < 4)
+				continue;
+
+			saved_filter *filter = new (std::nothrow) saved_filter;
+			if (filter == NULL)
+				break;
+			filter->vendorId = strtoul(device->values[0], NULL, 16);
+			filter->productId = strtoul(device->values[1], NULL, 16);
+			filter->reportId = strtoul(parameter->values[0], NULL, 0);
+			filter->index = strtol(parameter->values[1], NULL, 0);
+			filter->deadzone = strtod(parameter->values[2], NULL);
+			filter->hysteresis = strtod(parameter->values[3], NULL);
+			if (!fFilters.AddItem(filter))
+				delete filter;
+		}
+	}
+
+	unload_driver_settings(handle);
+}
+
+
+/*!	Remembers the filter of an item, or of all items of the report if
+	\a index is -1, and rewrites the settings file. The driver applies the
+	entries in order, so a filter for all items replaces the earlier ones.
+*/
+status_t
+UISFilterSettings::Set(uint16 vendorId, uint16 productId, uint8 reportId,
+	int32 index, float deadzone, float hysteresis)
+{
+	BAutolock _(fLock);
+
+	for (int32 i = fFilters.CountItems() - 1; i >= 0; i--) {
+		saved_filter *saved = (saved_filter *) fFilters.ItemAt(i);
+		if (saved->vendorId != vendorId || saved->productId != productId
+			|| saved->reportId != reportId)
+			continue;
+		if (index == -1 || saved->index == index) {
+			fFilters.RemoveItem(i);
+			delete saved;
+		}
+	}
+
+	saved_filter *filter = new (std::nothrow) saved_filter;
+	if (filter == NULL)
+		return B_NO_MEMORY;
+	filter->vendorId = vendorId;
+	filter->productId = productId;
+	filter->reportId = reportId;
+	filter->index = index;
+	filter->deadzone = deadzone;
+	filter->hysteresis = hysteresis;
+	if (!fFilters.AddItem(filter)) {
+		delete filter;
+		return B_NO_MEMORY;
+	}
+
+	return _Save();
+}
+
+
+status_t
+UISFilterSettings::_Save()
+{
+	BPath path;
+	status_t status = find_directory(B_USER_SETTINGS_DIRECTORY, &path, true);
+	if (status == B_OK)
+		status = path.Append("kernel/drivers/" USB_HID_FILTER_SETTINGS);
+	if (status != B_OK)
+		return status;
+
+	FILE *file = fopen(path.Path(), "w");
+	if (file == NULL) {
+		TRACE("could not write %s\n", path.Path());
+		return B_ERROR;
+	}
+
+	fprintf(file, "# written by the input_server, edits get overwritten\n");
+
+	// group the filters by device, keeping their order within each one
+	int32 count = fFilters.CountItems();
+	for (int32 i = 0; i < count; i++) {
+		saved_filter *first = (saved_filter *) fFilters.ItemAt(i);
+		bool written = false;
+		for (int32 j = 0; j < i && !written; j++) {
+			saved_filter *other = (saved_filter *) fFilters.ItemAt(j);
+			written = other->vendorId == first->vendorId
+				&& other->productId == first->productId;
+		}
+		if (written)
+			continue;
+
+		fprintf(file, "\ndevice %04x %04x {\n", first->vendorId,
+			first->productId);
+		for (int32 j = i; j < count; j++) {
+			saved_filter *filter = (saved_filter *) fFilters.ItemAt(j);
+			if (filter->vendorId != first->vendorId
+				|| filter->productId != first->productId)
+				continue;
+			fprintf(file, "\tfilter %u %ld %.4f %.4f\n",
+				filter->reportId, filter->index, filter->deadzone,
+				filter->hysteresis);
+				// plain decimals, the driver can't parse exponents
+		}
+		fprintf(file, "}\n");
+	}
+
+	status = ferror(file) ? B_IO_ERROR : B_OK;
+	if (fclose(file) != 0)
+		status = B_IO_ERROR;
+	return status;
+}
+
+
+void
+UISFilterSettings::_MakeEmpty()
+{
+	for (int32 i = 0; i < fFilters.CountItems(); i++)
+		delete (saved_filter *) fFilters.ItemAt(i);
+	fFilters.MakeEmpty();
+}
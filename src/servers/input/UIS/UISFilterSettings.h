@@ -0,0 +1,30 @@
+#ifndef _UIS_FILTER_SETTINGS_H
+#define _UIS_FILTER_SETTINGS_H
+
+#include <List.h>
+#include <Locker.h>
+
+
+/*!	The item filters set through the input_server, kept per USB device in
+	the USB_HID_FILTER_SETTINGS driver settings, which usb_hid applies when
+	the device gets attached.
+*/
+class UISFilterSettings {
+public:
+					UISFilterSettings();
+					~UISFilterSettings();
+
+	void			Load();
+	status_t		Set(uint16 vendorId, uint16 productId, uint8 reportId,
+						int32 index, float deadzone, float hysteresis);
+
+private:
+	status_t		_Save();
+	void			_MakeEmpty();
+
+	BLocker			fLock;
+	BList			fFilters;
+};
+
+
+#endif // _UIS_FILTER_SETTINGS_H
@@ -3,22 +3,36 @@
 #include "UISDevice.h"
 #include "UISReport.h"
 #include "UISTarget.h"
+#include "UISDeviceIO.h"
 
 #include <uis_driver.h>
 #include <UISProtocol.h>
 
+#include <Autolock.h>
+
+#include <math.h>
+#include <new>
+
 #include "UIS_debug.h"
 
 
+static int32 sNextTargetSerial = 0;
+
+
 UISReportItem::UISReportItem(int fd, UISReport *report, int32 index)
 	:
 	fUISReport(report),
-	fItem(NULL)
+	fItem(NULL),
+	fIsContinuous(false),
+	fValue(0.0f),
+	fValueStale(false),
+	fPolled(false),
+	fTargetLock("uis item targets")
 {
 	uis_item_info itemDesc;
 	itemDesc.in.report = report->Report();
 	itemDesc.in.index = index;
-	if (ioctl(fd, UIS_ITEM_INFO, &itemDesc) != B_OK)
+	if (uis_ioctl(fd, UIS_ITEM_INFO, &itemDesc) != B_OK)
 		return;
 	fItem = itemDesc.out.item;
 	fUsagePage = itemDesc.out.usage.page;
@@ -29,6 +43,22 @@ UISReportItem::UISReportItem(int fd, UISReport *report, int32 index)
 }
 
 
+UISReportItem::UISReportItem(UISReport *report, const uis_item_layout *layout)
+	:
+	fUISReport(report),
+	fItem(layout->item),
+	fUsagePage(layout->usage.page),
+	fUsageId(layout->usage.id),
+	fIsRelative((layout->flags & UIS_ITEM_RELATIVE) != 0),
+	fIsContinuous(layout->maximum - layout->minimum > 1),
+	fValue(0.0f),
+	fValueStale(false),
+	fPolled(false),
+	fTargetLock("uis item targets")
+{
+}
+
+
 UISReportItem::~UISReportItem()
 {
 	//TRACE("delete item usage id: 0x%02x\n", fUsageId);
@@ -45,56 +75,210 @@ UISReportItem::InitCheck()
 void
 UISReportItem::SetValue(float value)
 {
-	fValue = value;
+	{
+		BAutolock lock(fTargetLock);
+		fValue = value;
+		fValueStale = false;
+	}
 	//TRACE("set value for item %04x %04x: %08x\n", fUsagePage, fUsageId, fValue);
 
 	_SendEvents();
 }
 
 
+/*!	Sets the value of an item that just became polled, unless the reader
+	thread stored a newer one meanwhile. No events are sent, the reader
+	does that for the values of the reports.
+*/
+void
+UISReportItem::SetStaleValue(float value)
+{
+	BAutolock lock(fTargetLock);
+	if (fValueStale) {
+		fValue = value;
+		fValueStale = false;
+	}
+}
+
+
+/*!	Tells how pending events of this item may be merged when a target lags
+	behind. Without a known logical range, every event is kept.
+*/
+uint32
+UISReportItem::DeliveryMode()
+{
+	if (fIsRelative)
+		return UIS_DELIVER_ACCUMULATE;
+	if (fIsContinuous)
+		return UIS_DELIVER_LATEST;
+	return UIS_DELIVER_QUEUE;
+}
+
+
+bool
+UISReportItem::HasInterest()
+{
+	BAutolock lock(fTargetLock);
+	return fPolled || !fItemTargetList.IsEmpty();
+}
+
+
+/*!	Marks the item as polled, so that the driver keeps its value up to date
+	from now on. Returns whether the interest of the item changed.
+*/
+bool
+UISReportItem::SetPolled()
+{
+	BAutolock lock(fTargetLock);
+	if (fPolled)
+		return false;
+	fPolled = true;
+	fValueStale = fItemTargetList.IsEmpty();
+	return fValueStale;
+}
+
+
+/*!	The report interest is updated after the target lock is released, since
+	UISReport::UpdateInterest() locks the items of the report in turn.
+*/
 void
 UISReportItem::_SendEvents()
 {
 	UISManager *manager = fUISReport->Device()->Manager();
-	for (int32 i = 0; i < fItemTargetList.CountItems(); i++) {
-		uis_item_target *itemTarget =
-			(uis_item_target *) fItemTargetList.ItemAt(i);
-		status_t status = manager->SendEvent(itemTarget, this);
-		if (status == B_BAD_PORT_ID) {
-			fItemTargetList.RemoveItem(i--);
-			delete itemTarget;
+	bool lostInterest = false;
+	{
+		BAutolock lock(fTargetLock);
+		for (int32 i = 0; i < fItemTargetList.CountItems(); i++) {
+			uis_item_target *itemTarget =
+				(uis_item_target *) fItemTargetList.ItemAt(i);
+			float value = fValue;
+			bigtime_t dueTime;
+			if (!_ApplyLimits(itemTarget, value, dueTime))
+				continue;
+
+			status_t status = manager->SendEvent(itemTarget, this, value,
+				dueTime);
+			if (status == B_BAD_PORT_ID) {
+				fItemTargetList.RemoveItem(i--);
+				delete itemTarget;
+				lostInterest = !fPolled && fItemTargetList.IsEmpty();
+			}
 		}
 	}
+
+	if (lostInterest)
+		fUISReport->UpdateInterest();
+}
+
+
+/*!	Applies the minimum delta and rate limit of the subscription. Returns
+	false for a change below the minimum delta, which is dropped, otherwise
+	sets the value to send and when it is due. Relative changes are summed
+	up until they reach the minimum delta, and then sent as one.
+	Values held back by the rate limit are queued all the same, and the
+	target merges them with the later ones of the item: relative values add
+	up, absolute ones are replaced. So the last value still arrives once the
+	rate window expired.
+	Buttons are never held back or dropped, and neither are axes coming back
+	to rest. Called with fTargetLock held.
+*/
+bool
+UISReportItem::_ApplyLimits(uis_item_target *itemTarget, float &value,
+	bigtime_t &dueTime)
+{
+	bigtime_t now = system_time();
+	dueTime = now;
+	if (itemTarget->minimumDelta <= 0.0f && itemTarget->minimumInterval <= 0)
+		return true;
+
+	uint32 mode = DeliveryMode();
+	if (mode == UIS_DELIVER_QUEUE)
+		return true;
+
+	bool atRest = false;
+	if (mode == UIS_DELIVER_ACCUMULATE) {
+		itemTarget->pendingDelta += value;
+		if (fabs(itemTarget->pendingDelta) < itemTarget->minimumDelta)
+			return false;
+		value = itemTarget->pendingDelta;
+	} else {
+		atRest = (value == 0.0f);
+		if (!atRest
+			&& fabs(value - itemTarget->lastValue) < itemTarget->minimumDelta)
+			return false;
+	}
+
+	if (atRest)
+		dueTime = now;
+	else if (now < itemTarget->lastTime)
+		dueTime = itemTarget->lastTime;
+			// merges with the send that is already held back
+	else {
+		dueTime = max_c(now,
+			itemTarget->lastTime + itemTarget->minimumInterval);
+	}
+
+	itemTarget->lastValue = value;
+	itemTarget->lastTime = dueTime;
+	itemTarget->pendingDelta = 0.0f;
+	return true;
 }
 
 
 void
 UISReportItem::SetTarget(team_id team, port_id port, int32 token, void *cookie,
-	void **target)
+	float minimumDelta, float maximumRate, void **target)
 {
 	//TRACE("team: %d, port: %d, token: %d, cookie: %08x, target: %08x\n",
 	//	team, port, token, cookie, *target);
-	uis_item_target *itemTarget = (uis_item_target *) *target;
 	UISManager *manager = fUISReport->Device()->Manager();
+	bool interestChanged = false;
+	{
+		BAutolock lock(fTargetLock);
+		if (!lock.IsLocked())
+			return;
 
-	if (itemTarget != NULL)
-		manager->RemoveTarget(itemTarget->target);
-
-	if (team == -1 || port == -1 || token == B_NULL_TOKEN) {
-		if (itemTarget != NULL && fItemTargetList.HasItem(itemTarget)) {
-			fItemTargetList.RemoveItem(itemTarget);
-			delete itemTarget;
+		uis_item_target *itemTarget = (uis_item_target *) *target;
+		if (itemTarget != NULL && !fItemTargetList.HasItem(itemTarget))
 			itemTarget = NULL;
-		}
-		return;
-	}
+				// already removed, as its target went away
 
-	if (itemTarget == NULL) {
-		itemTarget = new uis_item_target;
-		fItemTargetList.AddItem(itemTarget);
-		*target = itemTarget;
+		if (itemTarget != NULL)
+			manager->RemoveTarget(itemTarget->target);
+
+		if (team == -1 || port == -1 || token == B_NULL_TOKEN) {
+			if (itemTarget != NULL) {
+				fItemTargetList.RemoveItem(itemTarget);
+				delete itemTarget;
+				*target = NULL;
+				interestChanged = !fPolled && fItemTargetList.IsEmpty();
+			}
+		} else {
+			if (itemTarget == NULL) {
+				itemTarget = new (std::nothrow) uis_item_target;
+				if (itemTarget == NULL
+					|| !fItemTargetList.AddItem(itemTarget)) {
+					delete itemTarget;
+					*target = NULL;
+					return;
+				}
+				itemTarget->serial
+					= (uint32) atomic_add(&sNextTargetSerial, 1);
+				*target = itemTarget;
+				interestChanged = !fPolled && fItemTargetList.CountItems() == 1;
+			}
+
+			itemTarget->target = manager->FindOrAddTarget(team, port, token);
+			itemTarget->cookie = cookie;
+			itemTarget->minimumDelta = minimumDelta;
+			itemTarget->minimumInterval = (maximumRate > 0.0f)
+				? (bigtime_t) (1000000.0f / maximumRate) : 0;
+			itemTarget->lastValue = fValue;
+			itemTarget->lastTime = 0;
+			itemTarget->pendingDelta = 0.0f;
+		}
 	}
 
-	itemTarget->target = manager->FindOrAddTarget(team, port, token);
-	itemTarget->cookie = cookie;
+	if (interestChanged)
+		fUISReport->UpdateInterest();
 }
@@ -2,45 +2,78 @@
 #define _UIS_ITEM_H
 
 #include <List.h>
+#include <Locker.h>
 #include <Messenger.h>
 
+#include <uis_driver.h>
+
 
 class UISTarget;
 class UISReport;
 
 
 typedef struct _uis_item_target {
+	uint32		serial;
+		// identifies the subscription in the queue of its target
 	UISTarget *	target;
 	void *		cookie;
+	float		minimumDelta;
+	bigtime_t	minimumInterval;
+	float		lastValue;
+		// of the last send, the base of the minimum delta
+	bigtime_t	lastTime;
+		// of the last send, may be in the future when it's held back
+	float		pendingDelta;
+		// relative values since the last send, for the minimum delta
 } uis_item_target;
 
 
 class UISReportItem {
 public:
 				UISReportItem(int fd, UISReport *report, int32 index);
+				UISReportItem(UISReport *report,
+					const uis_item_layout *layout);
 				~UISReportItem();
 
 	status_t	InitCheck();
+	UISReport *	Report() { return fUISReport; };
 	void		SetValue(float value);
+	void		SetStaleValue(float value);
 
 	uint16		UsagePage() { return fUsagePage; };
 	uint16		UsageId() { return fUsageId; };
 	bool		IsRelative() { return fIsRelative; };
+	bool		IsContinuous() { return fIsContinuous; };
 	float		Value() { return fValue; };
+	uint32		DeliveryMode();
+
+	bool		HasInterest();
+	bool		SetPolled();
 
 	void		SetTarget(team_id team, port_id port, int32 token, void *cookie,
-					void **target);
+					float minimumDelta, float maximumRate, void **target);
 
 private:
 	void		_SendEvents();
+	bool		_ApplyLimits(uis_item_target *itemTarget, float &value,
+					bigtime_t &dueTime);
 
 	UISReport *	fUISReport;
 	void *		fItem;
 	uint16		fUsagePage;
 	uint16		fUsageId;
 	bool		fIsRelative;
+	bool		fIsContinuous;
 	float		fValue;
+	bool		fValueStale;
+		// the driver left the item out of the reports, and no value came
+		// in since
+	bool		fPolled;
 	BList		fItemTargetList;
+	BLocker		fTargetLock;
+		// guards fPolled, fItemTargetList and its entries, as the reader
+		// thread sends events while the workers change the targets, and
+		// the stores to fValue
 };
 
 
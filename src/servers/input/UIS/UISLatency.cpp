@@ -0,0 +1,40 @@
+#include "UISLatency.h"
+
+#include <string.h>
+
+
+UISLatencyHistogram::UISLatencyHistogram()
+{
+	memset(fBuckets, 0, sizeof(fBuckets));
+}
+
+
+/*!	Counts the latency in the bucket of its power of two, so that recording
+	costs a few shifts and one atomic add.
+*/
+void
+UISLatencyHistogram::Record(bigtime_t latency)
+{
+	int32 bucket = 0;
+	while (latency > 1 && bucket < B_UIS_LATENCY_BUCKETS - 1) {
+		latency >>= 1;
+		bucket++;
+	}
+
+	atomic_add(&fBuckets[bucket], 1);
+}
+
+
+status_t
+UISLatencyHistogram::AddTo(BMessage *message, const char *name, bool reset)
+{
+	for (int32 i = 0; i < B_UIS_LATENCY_BUCKETS; i++) {
+		int32 count = reset ? atomic_set(&fBuckets[i], 0)
+			: atomic_get(&fBuckets[i]);
+		status_t status = message->AddInt32(name, count);
+		if (status != B_OK)
+			return status;
+	}
+
+	return B_OK;
+}
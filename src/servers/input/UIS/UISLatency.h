@@ -0,0 +1,21 @@
+#ifndef _UIS_LATENCY_H
+#define _UIS_LATENCY_H
+
+#include <Message.h>
+
+#include <UISProtocol.h>
+
+
+class UISLatencyHistogram {
+public:
+					UISLatencyHistogram();
+
+	void			Record(bigtime_t latency);
+	status_t		AddTo(BMessage *message, const char *name, bool reset);
+
+private:
+	int32			fBuckets[B_UIS_LATENCY_BUCKETS];
+};
+
+
+#endif // _UIS_LATENCY_H
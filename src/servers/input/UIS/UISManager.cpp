@@ -3,6 +3,7 @@
 #include "UISReport.h"
 #include "UISItem.h"
 #include "UISTarget.h"
+#include "UISTrace.h"
 
 #include <Autolock.h>
 #include <Entry.h>
@@ -12,8 +13,13 @@
 #include <PathMonitor.h>
 #include <uis_driver.h>
 #include <UISProtocol.h>
+#ifdef UIS_MOCK_DEVICES
+#include <uis_mock_device.h>
+#endif
 
 #include <new>
+#include <stdio.h>
+#include <string.h>
 
 using std::nothrow;
 
@@ -21,18 +27,98 @@ using std::nothrow;
 
 
 static const char kMonitoredPath[] = "/dev/input/hid";
-static const int32 kMaxDevices = 1000;
+static const char kTraceExportPath[] = "/var/log/uis_trace.json";
+static const int32 kRequestPortCapacity = 100;
+static const int32 kMinWorkerThreads = 2;
+static const int32 kMaxWorkerThreads = 8;
+static const int32 kWorkerThreadPriority = B_DISPLAY_PRIORITY;
+static const int32 kBringUpPortCapacity = 100;
+static const int32 kMaxBringUpThreads = 4;
+static const int32 kBringUpThreadPriority = B_NORMAL_PRIORITY;
+static const int32 kDeliveryThreadPriority = B_REAL_TIME_DISPLAY_PRIORITY;
+static const bigtime_t kDeliveryRetryDelay = 5000;
 
 
 //class UISNotifyTarget {
 //};
 
 
+static int32
+worker_thread_count(int32 maxCount)
+{
+	system_info info;
+	int32 count = kMinWorkerThreads;
+	if (get_system_info(&info) == B_OK && info.cpu_count > count)
+		count = info.cpu_count;
+	return (count > maxCount) ? maxCount : count;
+}
+
+
+/*!	Adds the counters of a device to the reply. \a interface is the device
+	whose entry has the counters of the USB interface, which are left at 0
+	for the other devices on it, so that they don't count twice.
+*/
+static status_t
+add_device_stats(BMessage *reply, uis_device_id id, uis_device_id interface,
+	const uis_stats_info &stats)
+{
+	status_t status = reply->AddInt32("device", id);
+	if (status == B_OK)
+		status = reply->AddInt32("interface", interface);
+	if (status == B_OK)
+		status = reply->AddInt32("transfers", stats.device.transfers);
+	if (status == B_OK) {
+		status = reply->AddInt32("transfer errors",
+			stats.device.transferErrors);
+	}
+	if (status == B_OK)
+		status = reply->AddInt32("stalls", stats.device.stalls);
+	if (status == B_OK)
+		status = reply->AddInt32("short reports", stats.device.shortReports);
+	if (status == B_OK)
+		status = reply->AddInt32("wakeups", stats.reports.wakeups);
+	if (status == B_OK) {
+		status = reply->AddInt32("interrupted wakeups",
+			stats.reports.interruptedWakeups);
+	}
+	if (status == B_OK)
+		status = reply->AddInt32("reports", stats.reports.reports);
+	if (status == B_OK)
+		status = reply->AddInt32("records", stats.reports.records);
+	if (status == B_OK)
+		status = reply->AddInt32("ring overflows", stats.reports.ringOverflows);
+	if (status == B_OK) {
+		status = reply->AddInt32("missed reports",
+			stats.reports.missedReports);
+	}
+	return status;
+}
+
+
+class DeviceReference {
+public:
+	DeviceReference(UISDevice *device) : fDevice(device) {}
+	~DeviceReference() { fDevice->ReleaseReference(); }
+
+private:
+	UISDevice *	fDevice;
+};
+
+
 UISManager::UISManager()
 	: BLooper("uis manager"),
 	fIsRunning(false),
-	fNextDeviceId(1),
-	fFreeDeviceIds(kMaxDevices)
+	fRequestPort(-1),
+	fWorkerThreads(NULL),
+	fWorkerCount(0),
+	fBringUpPort(-1),
+	fBringUpThreads(NULL),
+	fBringUpCount(0),
+	fPendingBringUps(0),
+	fBringUpStart(0),
+	fDeliverySem(-1),
+	fDeliveryThread(-1),
+	fReplayer(this)
 {
 }
 
@@ -41,12 +127,27 @@ UISManager::~UISManager()
 {
 	Stop();
 
-	BAutolock lock(fDeviceMapLock);
-	if (lock.IsLocked()) {
-		for (DeviceMap::iterator it = fDeviceMap.begin();
-				it != fDeviceMap.end(); it++)
-			delete it->second;
+	DeviceMap devices;
+	{
+		DeviceMapWriteLocker lock(fDeviceMapLock);
+		if (!lock.IsLocked())
+			return;
+		devices.swap(fDeviceMap);
+
+		NameIndex::Iterator iterator = fNameIndex.GetIterator();
+		while (iterator.HasNext()) {
+			NameLink *link = iterator.Next().value;
+			while (link != NULL) {
+				NameLink *next = link->next;
+				delete link;
+				link = next;
+			}
+		}
+		fNameIndex.Clear();
 	}
+
+	for (DeviceMap::iterator it = devices.begin(); it != devices.end(); it++)
+		it->second->ReleaseReference();
 }
 
 
@@ -61,8 +162,19 @@ UISManager::Start()
 				// not tracing B_ENTRY_REMOVED, since we're the one who's
 				// removing it
 	fIsRunning = (status == B_OK);
+
+	fFilterSettings.Load();
+	if (uis_trace_init() != B_OK)
+		TRACE("uis trace unavailable\n");
+	if (_StartDelivery() != B_OK)
+		TRACE("uis delivery thread unavailable, delivering inline\n");
+	if (_StartBringUp() != B_OK)
+		TRACE("uis bring-up threads unavailable, adding devices inline\n");
 	_RecursiveScan(kMonitoredPath);
 
+	if (_StartWorkers() != B_OK)
+		TRACE("uis request port unavailable, using input_server looper\n");
+
 	TRACE("uis start status: %d\n", status);
 	return status;
 }
@@ -71,6 +183,12 @@ UISManager::Start()
 void
 UISManager::Stop()
 {
+	fReplayer.Stop();
+	fRecorder.Stop();
+	_StopWorkers();
+	_StopBringUp();
+	_StopDelivery();
+
 	if (fIsRunning) {
 		BPathMonitor::StopWatching(kMonitoredPath, this);
 		fIsRunning = false;
@@ -78,6 +196,364 @@ UISManager::Stop()
 }
 
 
+status_t
+UISManager::_StartWorkers()
+{
+	if (fRequestPort >= 0)
+		return B_OK;
+
+	fRequestPort = create_port(kRequestPortCapacity, "uis requests");
+	if (fRequestPort < B_OK)
+		return fRequestPort;
+
+	int32 count = worker_thread_count(kMaxWorkerThreads);
+	fWorkerThreads = new (std::nothrow) thread_id[count];
+	if (fWorkerThreads == NULL) {
+		_StopWorkers();
+		return B_NO_MEMORY;
+	}
+
+	for (int32 i = 0; i < count; i++) {
+		char threadName[B_OS_NAME_LENGTH];
+		snprintf(threadName, B_OS_NAME_LENGTH, "uis request worker %ld", i);
+		thread_id thread = spawn_thread(_WorkerThreadEntry, threadName,
+			kWorkerThreadPriority, (void *) this);
+		if (thread < B_OK)
+			break;
+		fWorkerThreads[fWorkerCount++] = thread;
+		resume_thread(thread);
+	}
+
+	if (fWorkerCount == 0) {
+		_StopWorkers();
+		return B_ERROR;
+	}
+
+	TRACE("uis request port %ld served by %ld workers\n", fRequestPort,
+		fWorkerCount);
+	return B_OK;
+}
+
+
+void
+UISManager::_StopWorkers()
+{
+	if (fRequestPort >= 0) {
+		delete_port(fRequestPort);
+			// makes every worker blocked on the port return
+		fRequestPort = -1;
+	}
+
+	for (int32 i = 0; i < fWorkerCount; i++)
+		wait_for_thread(fWorkerThreads[i], NULL);
+
+	delete [] fWorkerThreads;
+	fWorkerThreads = NULL;
+	fWorkerCount = 0;
+}
+
+
+status_t
+UISManager::_WorkerThreadEntry(void *arg)
+{
+	((UISManager *) arg)->_WorkerThread();
+	return B_OK;
+}
+
+
+void
+UISManager::_WorkerThread()
+{
+	port_id port = fRequestPort;
+	uint8 *buffer = NULL;
+	ssize_t bufferSize = 0;
+
+	while (true) {
+		ssize_t size;
+		int32 code;
+
+		{
+			// only one worker waits on the port at a time, so the size
+			// we get is the size of the message we're going to read
+			BAutolock lock(fRequestPortLock);
+			if (!lock.IsLocked())
+				break;
+
+			size = port_buffer_size(port);
+			if (size < B_OK)
+				break;
+
+			if (size > bufferSize) {
+				uint8 *newBuffer = new (std::nothrow) uint8[size];
+				if (newBuffer == NULL) {
+					read_port(port, &code, NULL, 0);
+						// drop the request, client will time out
+					continue;
+				}
+				delete [] buffer;
+				buffer = newBuffer;
+				bufferSize = size;
+			}
+
+			size = read_port(port, &code, buffer, size);
+			if (size < B_OK)
+				break;
+		}
+
+		BMessage message;
+		if (message.Unflatten((const char *) buffer) != B_OK)
+			continue;
+
+		int32 opcode;
+		if (message.FindInt32("opcode", &opcode) != B_OK)
+			opcode = 0;
+
+		BMessage reply;
+		UIS_TRACE_BEGIN(UIS_TRACE_REQUEST, opcode, 0);
+		status_t status = HandleMessage(&message, &reply);
+		UIS_TRACE_END(UIS_TRACE_REQUEST, opcode, status);
+		reply.AddInt32("status", status);
+		message.SendReply(&reply);
+	}
+
+	delete [] buffer;
+}
+
+
+status_t
+UISManager::_StartBringUp()
+{
+	if (fBringUpPort >= 0)
+		return B_OK;
+
+	fBringUpPort = create_port(kBringUpPortCapacity, "uis device bring-up");
+	if (fBringUpPort < B_OK)
+		return fBringUpPort;
+
+	int32 count = worker_thread_count(kMaxBringUpThreads);
+	fBringUpThreads = new (std::nothrow) thread_id[count];
+	if (fBringUpThreads == NULL) {
+		_StopBringUp();
+		return B_NO_MEMORY;
+	}
+
+	for (int32 i = 0; i < count; i++) {
+		char threadName[B_OS_NAME_LENGTH];
+		snprintf(threadName, B_OS_NAME_LENGTH, "uis device bring-up %ld", i);
+		thread_id thread = spawn_thread(_BringUpThreadEntry, threadName,
+			kBringUpThreadPriority, (void *) this);
+		if (thread < B_OK)
+			break;
+		fBringUpThreads[fBringUpCount++] = thread;
+		resume_thread(thread);
+	}
+
+	if (fBringUpCount == 0) {
+		_StopBringUp();
+		return B_ERROR;
+	}
+
+	return B_OK;
+}
+
+
+void
+UISManager::_StopBringUp()
+{
+	if (fBringUpPort >= 0) {
+		delete_port(fBringUpPort);
+		fBringUpPort = -1;
+	}
+
+	for (int32 i = 0; i < fBringUpCount; i++)
+		wait_for_thread(fBringUpThreads[i], NULL);
+
+	delete [] fBringUpThreads;
+	fBringUpThreads = NULL;
+	fBringUpCount = 0;
+}
+
+
+status_t
+UISManager::_BringUpThreadEntry(void *arg)
+{
+	((UISManager *) arg)->_BringUpThread();
+	return B_OK;
+}
+
+
+void
+UISManager::_BringUpThread()
+{
+	port_id port = fBringUpPort;
+	char path[B_PATH_NAME_LENGTH];
+
+	while (true) {
+		int32 id;
+		ssize_t size = read_port(port, &id, path, sizeof(path) - 1);
+		if (size < B_OK)
+			break;
+		path[size] = 0;
+
+		_BringUpDevice(id, path);
+
+		if (atomic_add(&fPendingBringUps, -1) == 1) {
+			TRACE("all pending devices up after %lld us\n",
+				system_time() - fBringUpStart);
+		}
+	}
+}
+
+
+/*!	Opens the device and queries its layout. This is where most of the time
+	adding a device goes, so it's done without holding the device map lock,
+	and on the bring-up threads so that several devices can come up at once.
+*/
+void
+UISManager::_BringUpDevice(uis_device_id id, const char *path)
+{
+	bigtime_t start = system_time();
+
+	UIS_TRACE_BEGIN(UIS_TRACE_DEVICE_ADD, id, 0);
+	UISDevice *device = new (std::nothrow) UISDevice(id, this, path);
+	if (device != NULL && device->InitCheck() == B_OK) {
+		const char *name = device->Name();
+			// resolved before locking, it may need a round trip
+
+		bool added = false;
+		{
+			DeviceMapWriteLocker lock(fDeviceMapLock);
+			if (lock.IsLocked()) {
+				try {
+					fDeviceMap.insert(std::make_pair(id, device));
+					if (_AddToIndices(device, name) == B_OK) {
+						device->AcquireReference();
+							// keeps the device around while notifying
+						added = true;
+					} else
+						fDeviceMap.erase(id);
+				} catch (...) {}
+			}
+		}
+
+		if (added) {
+			TRACE("device %s up in %lld us\n", path, system_time() - start);
+			UIS_TRACE_END(UIS_TRACE_DEVICE_ADD, id, 0);
+			_NotifyWatchers(B_UIS_DEVICE_ADDED, device);
+
+			if (device->StartReading() != B_OK)
+				RemoveDevice(id, device);
+					// a reader of a device unplugged meanwhile removes it, too
+			device->ReleaseReference();
+			return;
+		}
+	}
+
+	DeviceMapWriteLocker lock(fDeviceMapLock);
+	if (lock.IsLocked()) {
+		fPathIndex.Remove(HashString(path));
+		fDeviceIds.Free(id);
+	}
+
+	if (device != NULL)
+		device->ReleaseReference();
+	UIS_TRACE_END(UIS_TRACE_DEVICE_ADD, id, 0);
+}
+
+
+status_t
+UISManager::_StartDelivery()
+{
+	if (fDeliverySem >= 0)
+		return B_OK;
+
+	fDeliverySem = create_sem(0, "uis delivery");
+	if (fDeliverySem < B_OK)
+		return fDeliverySem;
+
+	fDeliveryThread = spawn_thread(_DeliveryThreadEntry, "uis delivery",
+		kDeliveryThreadPriority, (void *) this);
+	if (fDeliveryThread < B_OK) {
+		status_t status = fDeliveryThread;
+		_StopDelivery();
+		return status;
+	}
+
+	return resume_thread(fDeliveryThread);
+}
+
+
+void
+UISManager::_StopDelivery()
+{
+	if (fDeliverySem >= 0) {
+		delete_sem(fDeliverySem);
+		fDeliverySem = -1;
+	}
+
+	if (fDeliveryThread >= 0) {
+		wait_for_thread(fDeliveryThread, NULL);
+		fDeliveryThread = -1;
+	}
+}
+
+
+status_t
+UISManager::_DeliveryThreadEntry(void *arg)
+{
+	((UISManager *) arg)->_DeliveryThread();
+	return B_OK;
+}
+
+
+/*!	Sends the events queued by the report reader threads. Target ports are
+	only ever written without blocking; targets whose port is full keep
+	their events and are retried a little later, so a stuck application
+	neither delays the readers nor any other target.
+*/
+void
+UISManager::_DeliveryThread()
+{
+	sem_id sem = fDeliverySem;
+	bigtime_t timeout = B_INFINITE_TIMEOUT;
+
+	while (true) {
+		status_t status = acquire_sem_etc(sem, 1, B_RELATIVE_TIMEOUT,
+			timeout);
+		if (status != B_OK && status != B_TIMED_OUT
+				&& status != B_INTERRUPTED)
+			break;
+
+		BAutolock lock(fTargetListLocker);
+		if (!lock.IsLocked())
+			break;
+
+		int32 targets = fTargetList.CountItems();
+		bool blocked = false;
+		bigtime_t nextDue = B_INFINITE_TIMEOUT;
+		UIS_TRACE_BEGIN(UIS_TRACE_DELIVERY, targets, 0);
+		for (int32 i = 0; i < targets; i++) {
+			UISTarget *target = (UISTarget *) fTargetList.ItemAt(i);
+			bigtime_t targetDue;
+			if (target->DeliverEvents(&fDeliveryLatency, &fTotalLatency,
+					&targetDue) == B_WOULD_BLOCK)
+				blocked = true;
+			if (targetDue < nextDue)
+				nextDue = targetDue;
+		}
+		UIS_TRACE_END(UIS_TRACE_DELIVERY, targets, blocked);
+
+		timeout = blocked ? kDeliveryRetryDelay : B_INFINITE_TIMEOUT;
+		if (nextDue != B_INFINITE_TIMEOUT) {
+			bigtime_t untilDue = max_c(nextDue - system_time(), 0);
+			if (untilDue < timeout)
+				timeout = untilDue;
+				// events held back by a rate limit are flushed when due
+		}
+	}
+}
+
+
 void
 UISManager::_RecursiveScan(const char *directory)
 {
@@ -101,42 +577,104 @@ UISManager::_AddDevice(const char *path)
 {
 	TRACE("please create %s\n", path);
 
-	BAutolock lock(fDeviceMapLock);
-	if (!lock.IsLocked() || fFreeDeviceIds == 0)
-		return;
+	uis_device_id id;
+	{
+		DeviceMapWriteLocker lock(fDeviceMapLock);
+		if (!lock.IsLocked())
+			return;
 
-	for (DeviceMap::iterator it = fDeviceMap.begin(); it != fDeviceMap.end();
-			it++)
-		if (it->second->HasPath(path))
+		if (fPathIndex.ContainsKey(HashString(path)))
 			return;
 				// already have this device, thank you
 
-	UISDevice *device = new (std::nothrow) UISDevice(fNextDeviceId, this, path);
-	if (device == NULL)
-		return;
-	if (device->InitCheck() != B_OK) {
-		delete device;
-		return;
+		id = fDeviceIds.Allocate();
+		if (id < 0)
+			return;
+
+		if (fPathIndex.Put(HashString(path), id) != B_OK) {
+			fDeviceIds.Free(id);
+			return;
+		}
+			// reserves the path while the device is brought up
 	}
 
-	try {
-		// trying to find free device id, limited to one loop pass
-		for (int32 i = 0; i < kMaxDevices; i++) {
-			std::pair<DeviceMap::iterator, bool> ret
-				= fDeviceMap.insert(std::make_pair(fNextDeviceId, device));
-			if (ret.second) {
-					// success
-				fNextDeviceId++;
-				fFreeDeviceIds--;
-				return;
-			}
-			if (++fNextDeviceId > kMaxDevices)
-				fNextDeviceId = 1;
-					// device ids ranges from 1 to kMaxDevices
-		}		
-	} catch (...) {}
+	if (fBringUpPort >= 0) {
+		if (atomic_add(&fPendingBringUps, 1) == 0)
+			fBringUpStart = system_time();
+				// a new burst of devices starts
+		if (write_port(fBringUpPort, id, path, strlen(path)) == B_OK)
+			return;
+		atomic_add(&fPendingBringUps, -1);
+	}
+
+	_BringUpDevice(id, path);
+}
+
+
+/*!	Called with the device map lock held. The name has to be resolved by
+	the caller beforehand, as that may take a round trip to the driver.
+	Either both indices are updated, or none of them.
+*/
+status_t
+UISManager::_AddToIndices(UISDevice *device, const char *name)
+{
+	HashString path(device->Path());
+	bool hadPath = fPathIndex.ContainsKey(path);
+	status_t status = fPathIndex.Put(path, device->Id());
+	if (status != B_OK || name == NULL)
+		return status;
+
+	HashString key(name);
+	NameLink *link = new (std::nothrow) NameLink;
+	NameLink *first = fNameIndex.Get(key);
+	if (link == NULL || (first == NULL && fNameIndex.Put(key, link) != B_OK)) {
+		delete link;
+		if (!hadPath)
+			fPathIndex.Remove(path);
+		return B_NO_MEMORY;
+	}
 
-	delete device;
+	link->id = device->Id();
+	link->next = NULL;
+	if (first != NULL) {
+		while (first->next != NULL)
+			first = first->next;
+		first->next = link;
+	}
+	return B_OK;
+}
+
+
+/*!	Called with the device map lock held, with the same name the device was
+	added with.
+*/
+void
+UISManager::_RemoveFromIndices(UISDevice *device, const char *name)
+{
+	fPathIndex.Remove(HashString(device->Path()));
+
+	if (name == NULL)
+		return;
+
+	HashString key(name);
+	NameLink *first = fNameIndex.Get(key);
+	NameLink *previous = NULL;
+	for (NameLink *link = first; link != NULL; link = link->next) {
+		if (link->id != device->Id()) {
+			previous = link;
+			continue;
+		}
+
+		if (previous != NULL)
+			previous->next = link->next;
+		else if (link->next != NULL)
+			fNameIndex.Put(key, link->next);
+				// replaces the value, there is no allocation that could fail
+		else
+			fNameIndex.Remove(key);
+		delete link;
+		break;
+	}
 }
 
 
@@ -179,13 +717,71 @@ UISManager::HandleMessage(BMessage *message, BMessage *reply)
 		return status;
 
 	switch (opcode) {
+		case B_UIS_GET_SERVER_PORT:
+			{
+				if (fRequestPort < 0) {
+					// tells the kit not to ask again
+					return reply->AddInt32("port", -1);
+				}
+
+				port_info info;
+				status = get_port_info(fRequestPort, &info);
+				if (status != B_OK)
+					break;
+				status = reply->AddInt32("port", fRequestPort);
+				if (status != B_OK)
+					break;
+				return reply->AddInt32("team", info.team);
+			}
+
+		case B_UIS_START_WATCHING:
+			{
+				team_id team;
+				port_id port;
+				int32 token;
+				if (message->FindInt32("team id", (int32 *) &team) != B_OK
+						|| message->FindInt32("looper port", (int32 *) &port)
+							!= B_OK
+						|| message->FindInt32("object token", &token) != B_OK)
+					break;
+
+				UISTarget *target = FindOrAddTarget(team, port, token);
+				if (target == NULL)
+					break;
+
+				BAutolock lock(fTargetListLocker);
+				if (!lock.IsLocked())
+					break;
+				if (fWatcherList.HasItem(target)) {
+					RemoveTarget(target);
+						// already watching, keep a single reference
+				} else if (!fWatcherList.AddItem(target)) {
+					RemoveTarget(target);
+					break;
+				}
+				return reply->AddPointer("target", target);
+			}
+
+		case B_UIS_STOP_WATCHING:
+			{
+				void *target;
+				if (message->FindPointer("target", &target) != B_OK)
+					break;
+
+				BAutolock lock(fTargetListLocker);
+				if (!lock.IsLocked() || !fWatcherList.RemoveItem(target))
+					break;
+				RemoveTarget((UISTarget *) target);
+				return B_OK;
+			}
+
 		case B_UIS_NEXT_DEVICE:
 			{
 				uis_device_id id;
 				if (message->FindInt32("device", &id) != B_OK)
 					break;
 
-				BAutolock lock(fDeviceMapLock);
+				DeviceMapReadLocker lock(fDeviceMapLock);
 				if (!lock.IsLocked())
 					break;
 
@@ -197,21 +793,269 @@ UISManager::HandleMessage(BMessage *message, BMessage *reply)
 				return reply->AddInt32("next", found->first);
 			}
 
+		case B_UIS_FIND_DEVICES:
+			{
+				// all fields are optional, devices have to match all given
+				// items and one of the given application usages
+				int32 usageCount = 0;
+				message->GetInfo("page", NULL, &usageCount);
+				int32 itemCount = 0;
+				message->GetInfo("item page", NULL, &itemCount);
+
+				DeviceMapReadLocker lock(fDeviceMapLock);
+				if (!lock.IsLocked())
+					break;
+
+				status = B_OK;
+				for (DeviceMap::iterator it = fDeviceMap.begin();
+						it != fDeviceMap.end() && status == B_OK; it++) {
+					UISDevice *device = it->second;
+					bool matches = usageCount == 0;
+					for (int32 i = 0; !matches && i < usageCount; i++) {
+						uint16 usagePage, usageId;
+						matches = message->FindInt16("page", i,
+								(int16 *) &usagePage) == B_OK
+							&& message->FindInt16("id", i,
+								(int16 *) &usageId) == B_OK
+							&& device->UsagePage() == usagePage
+							&& device->UsageId() == usageId;
+					}
+
+					for (int32 i = 0; matches && i < itemCount; i++) {
+						uint16 itemPage, itemId;
+						uint8 type;
+						matches = message->FindInt16("item page", i,
+								(int16 *) &itemPage) == B_OK
+							&& message->FindInt16("item id", i,
+								(int16 *) &itemId) == B_OK
+							&& message->FindInt8("item type", i,
+								(int8 *) &type) == B_OK
+							&& device->FindItem(type, itemPage, itemId);
+					}
+
+					if (matches)
+						status = reply->AddInt32("device", it->first);
+				}
+				return status;
+			}
+
+		case B_UIS_GET_STATS:
+			{
+				// one entry per device in each field, for all devices unless
+				// one is given; the interface counters are only in the entry
+				// of the first device of each interface
+				uis_device_id id;
+				bool allDevices = message->FindInt32("device", &id) != B_OK;
+				bool reset;
+				if (message->FindBool("reset", &reset) != B_OK)
+					reset = false;
+
+				// the devices are only collected under the device map lock,
+				// as querying them takes an ioctl per report
+				DeviceMap devices;
+				status = B_OK;
+				{
+					DeviceMapReadLocker lock(fDeviceMapLock);
+					if (!lock.IsLocked())
+						break;
+
+					for (DeviceMap::iterator it = fDeviceMap.begin();
+							it != fDeviceMap.end(); it++) {
+						if (!allDevices && it->first != id)
+							continue;
+
+						try {
+							devices.insert(*it);
+						} catch (...) {
+							status = B_NO_MEMORY;
+							break;
+						}
+						it->second->AcquireReference();
+					}
+				}
+
+				std::map<void *, uis_device_id> interfaces;
+				for (DeviceMap::iterator it = devices.begin();
+						it != devices.end(); it++) {
+					DeviceReference reference(it->second);
+					if (status != B_OK)
+						continue;
+
+					uis_stats_info stats;
+					if (it->second->GetStats(&stats, reset) != B_OK)
+						continue;
+
+					uis_device_id interface = it->first;
+					std::map<void *, uis_device_id>::iterator found
+						= interfaces.find(stats.interface);
+					if (found == interfaces.end())
+						interfaces[stats.interface] = it->first;
+					else {
+						interface = found->second;
+						memset(&stats.device, 0, sizeof(stats.device));
+					}
+					status = add_device_stats(reply, it->first, interface,
+						stats);
+				}
+				return status;
+			}
+
+		case B_UIS_GET_LATENCY:
+			{
+				// a "devices" message for every device, unless one is given
+				uis_device_id id;
+				bool allDevices = message->FindInt32("device", &id) != B_OK;
+				bool reset;
+				if (message->FindBool("reset", &reset) != B_OK)
+					reset = false;
+
+				DeviceMapReadLocker lock(fDeviceMapLock);
+				if (!lock.IsLocked())
+					break;
+
+				for (DeviceMap::iterator it = fDeviceMap.begin();
+						it != fDeviceMap.end(); it++) {
+					if (!allDevices && it->first != id)
+						continue;
+
+					UISDevice *device = it->second;
+					BMessage latency;
+					latency.AddInt32("device", it->first);
+					latency.AddString("name", device->Name());
+					device->DriverLatency().AddTo(&latency, "driver", reset);
+					device->ReadLatency().AddTo(&latency, "read", reset);
+					device->DispatchLatency().AddTo(&latency, "dispatch",
+						reset);
+					status = reply->AddMessage("devices", &latency);
+					if (status != B_OK)
+						return status;
+				}
+
+				// targets get events of all devices
+				status = fDeliveryLatency.AddTo(reply, "delivery", reset);
+				if (status == B_OK)
+					status = fTotalLatency.AddTo(reply, "total", reset);
+				return status;
+			}
+
+		case B_UIS_EXPORT_TRACE:
+			{
+				const char *path;
+				if (message->FindString("path", &path) != B_OK)
+					path = kTraceExportPath;
+
+				status = uis_trace_export(path);
+				if (status == B_OK)
+					status = reply->AddString("path", path);
+
+				int32 threads, records;
+				uis_trace_losses(&threads, &records);
+				if (status == B_OK)
+					status = reply->AddInt32("untraced threads", threads);
+				if (status == B_OK)
+					status = reply->AddInt32("lost records", records);
+				return status;
+			}
+
+		case B_UIS_START_RECORDING:
+			{
+				const char *path;
+				if (message->FindString("path", &path) != B_OK)
+					break;
+				return fRecorder.Start(path);
+			}
+
+		case B_UIS_STOP_RECORDING:
+			fRecorder.Stop();
+			return B_OK;
+
+		case B_UIS_START_REPLAY:
+			{
+				const char *path;
+				if (message->FindString("path", &path) != B_OK)
+					break;
+				float speed;
+				if (message->FindFloat("speed", &speed) != B_OK)
+					speed = 1.0f;
+				bool wait;
+				if (message->FindBool("wait", &wait) != B_OK)
+					wait = false;
+
+				status = fReplayer.Start(path, speed);
+				if (status != B_OK || !wait)
+					return status;
+
+				// This blocks the worker for the whole replay. There's only
+				// ever one replay, so the other workers keep serving, but
+				// without a request port this is the input_server looper.
+
+				int32 reports;
+				bigtime_t elapsed;
+				status = fReplayer.Wait(&reports, &elapsed);
+				reply->AddInt32("reports", reports);
+				reply->AddInt64("elapsed", elapsed);
+				return status;
+			}
+
+		case B_UIS_STOP_REPLAY:
+			fReplayer.Stop();
+			return B_OK;
+
+#ifdef UIS_MOCK_DEVICES
+		case B_UIS_ADD_MOCK_DEVICES:
+			{
+				int32 count;
+				if (message->FindInt32("count", &count) != B_OK)
+					count = 1;
+
+				uis_mock_config config;
+				if (message->FindInt32("rate", &config.reportRate) != B_OK)
+					config.reportRate = 125;
+				if (message->FindInt32("items", &config.itemCount) != B_OK)
+					config.itemCount = 4;
+				if (message->FindInt32("pattern", &config.pattern) != B_OK)
+					config.pattern = UIS_MOCK_RAMP;
+				if (message->FindFloat("change",
+						&config.changeProbability) != B_OK)
+					config.changeProbability = 0.5f;
+				if (message->FindBool("relative", &config.relative) != B_OK)
+					config.relative = false;
+				int32 seed;
+				if (message->FindInt32("seed", &seed) != B_OK)
+					seed = 1;
+
+				for (int32 i = 0; i < count; i++) {
+					config.seed = seed + i;
+					char path[B_PATH_NAME_LENGTH];
+					status = uis_mock_create(&config, path, sizeof(path));
+					if (status != B_OK)
+						return status;
+					_AddDevice(path);
+					reply->AddString("path", path);
+				}
+				return B_OK;
+			}
+
+		case B_UIS_REMOVE_MOCK_DEVICES:
+			uis_mock_remove_all();
+				// the readers see the devices go and remove them
+			return B_OK;
+#endif
+
 		case B_UIS_FIND_DEVICE:
 			{
 				const char *name;
 				if (message->FindString("name", &name) != B_OK)
 					break;
 
-				BAutolock lock(fDeviceMapLock);
+				DeviceMapReadLocker lock(fDeviceMapLock);
 				if (!lock.IsLocked())
 					break;
 
-				for (DeviceMap::iterator it = fDeviceMap.begin();
-						it != fDeviceMap.end(); it++)
-					if (name != NULL && it->second->HasName(name))
-						return reply->AddInt32("device", it->first);
-				break;
+				NameLink *link = fNameIndex.Get(HashString(name));
+				if (link == NULL)
+					break;
+				return reply->AddInt32("device", link->id);
 			}
 
 		case B_UIS_GET_DEVICE:
@@ -220,13 +1064,10 @@ UISManager::HandleMessage(BMessage *message, BMessage *reply)
 				if (message->FindInt32("device", &id) != B_OK)
 					break;
 
-				BAutolock lock(fDeviceMapLock);
-				if (!lock.IsLocked())
-					break;
-
-				UISDevice *device = _Device(id);
+				UISDevice *device = _AcquireDevice(id);
 				if (device == NULL)
 					break;
+				DeviceReference reference(device);
 
 				status = reply->AddString("name", device->Name());
 				if (status != B_OK)
@@ -262,13 +1103,10 @@ UISManager::HandleMessage(BMessage *message, BMessage *reply)
 						|| message->FindInt8("type", (int8 *) &type) != B_OK)
 					break;
 
-				BAutolock lock(fDeviceMapLock);
-				if (!lock.IsLocked())
-					break;
-
-				UISDevice *device = _Device(id);
+				UISDevice *device = _AcquireDevice(id);
 				if (device == NULL)
 					break;
+				DeviceReference reference(device);
 				UISReport *report = device->ReportAt(type, index);
 				if (report == NULL)
 					break;
@@ -285,13 +1123,10 @@ UISManager::HandleMessage(BMessage *message, BMessage *reply)
 						|| message->FindInt8("type", (int8 *) &type) != B_OK)
 					break;
 
-				BAutolock lock(fDeviceMapLock);
-				if (!lock.IsLocked())
-					break;
-
-				UISDevice *device = _Device(id);
+				UISDevice *device = _AcquireDevice(id);
 				if (device == NULL)
 					break;
+				DeviceReference reference(device);
 				UISReport *report = device->ReportAt(type, index);
 				if (report != NULL)
 					return report->SendReport(message);
@@ -309,13 +1144,10 @@ UISManager::HandleMessage(BMessage *message, BMessage *reply)
 						|| message->FindInt32("item", &itemIndex) != B_OK)
 					break;
 
-				BAutolock lock(fDeviceMapLock);
-				if (!lock.IsLocked())
-					break;
-
-				UISDevice *device = _Device(id);
+				UISDevice *device = _AcquireDevice(id);
 				if (device == NULL)
 					break;
+				DeviceReference reference(device);
 				UISReport *report = device->ReportAt(type, reportIndex);
 				if (report == NULL)
 					break;
@@ -343,28 +1175,20 @@ UISManager::HandleMessage(BMessage *message, BMessage *reply)
 					|| message->FindInt16("id", (int16 *) &usageId) != B_OK)
 					break;
 
-				BAutolock lock(fDeviceMapLock);
-				if (!lock.IsLocked())
+				UISDevice *device = _AcquireDevice(id);
+				if (device == NULL)
 					break;
+				DeviceReference reference(device);
 
-				UISDevice *device = _Device(id);
-				if (device == NULL)
+				int32 reportIndex, itemIndex;
+				if (!device->FindItem(type, usagePage, usageId, &reportIndex,
+						&itemIndex))
 					break;
 
-				for (int32 ir = 0; ir < device->CountReports(type); ir++) {
-					UISReport *report = device->ReportAt(type, ir);
-					for (int32 ii = 0; ii < report->CountItems(); ii++) {
-						UISReportItem *item = report->ItemAt(ii);
-						if (item->UsagePage() == usagePage
-								&& item->UsageId() == usageId) {
-							status = reply->AddInt32("report", ir);
-							if (status != B_OK)
-								break;
-							return reply->AddInt32("item", ii);
-						}
-					}
-				}
-				break;
+				status = reply->AddInt32("report", reportIndex);
+				if (status != B_OK)
+					break;
+				return reply->AddInt32("item", itemIndex);
 			}
 
 		case B_UIS_ITEM_POLL_VALUE:
@@ -378,19 +1202,25 @@ UISManager::HandleMessage(BMessage *message, BMessage *reply)
 						|| message->FindInt32("item", &itemIndex) != B_OK)
 					break;
 
-				BAutolock lock(fDeviceMapLock);
-				if (!lock.IsLocked())
-					break;
-
-				UISDevice *device = _Device(id);
+				UISDevice *device = _AcquireDevice(id);
 				if (device == NULL)
 					break;
+				DeviceReference reference(device);
 				UISReport *report = device->ReportAt(type, reportIndex);
 				if (report == NULL)
 					break;
 				UISReportItem *item = report->ItemAt(itemIndex);
 				if (item == NULL)
 					break;
+				if (item->SetPolled()) {
+					report->UpdateInterest();
+
+					// the driver left the item out of the reports so far,
+					// take its value from the last report the driver got
+					float value;
+					if (report->GetItemValue(itemIndex, &value) == B_OK)
+						item->SetStaleValue(value);
+				}
 				return reply->AddFloat("value", item->Value());
 			}
 
@@ -419,14 +1249,17 @@ UISManager::HandleMessage(BMessage *message, BMessage *reply)
 				void *cookie;
 				if (message->FindPointer("cookie", &cookie) != B_OK)
 					cookie = NULL;
-
-				BAutolock lock(fDeviceMapLock);
-				if (!lock.IsLocked())
-					break;
-
-				UISDevice *device = _Device(id);
+				float minimumDelta;
+				if (message->FindFloat("minimum delta", &minimumDelta) != B_OK)
+					minimumDelta = 0.0f;
+				float maximumRate;
+				if (message->FindFloat("maximum rate", &maximumRate) != B_OK)
+					maximumRate = 0.0f;
+
+				UISDevice *device = _AcquireDevice(id);
 				if (device == NULL)
 					break;
+				DeviceReference reference(device);
 				UISReport *report = device->ReportAt(type, reportIndex);
 				if (report == NULL)
 					break;
@@ -434,9 +1267,72 @@ UISManager::HandleMessage(BMessage *message, BMessage *reply)
 				if (item == NULL)
 					break;
 
-				item->SetTarget(team, port, token, cookie, &target);
+				item->SetTarget(team, port, token, cookie, minimumDelta,
+					maximumRate, &target);
 				return reply->AddPointer("target", target);
 			}
+
+		case B_UIS_ITEM_SET_FILTER:
+			{
+				uis_device_id id;
+				uint8 type;
+				int32 reportIndex, itemIndex;
+				float deadzone, hysteresis;
+				if (message->FindInt32("device", &id) != B_OK
+						|| message->FindInt8("type", (int8 *) &type) != B_OK
+						|| message->FindInt32("report", &reportIndex) != B_OK
+						|| message->FindInt32("item", &itemIndex) != B_OK
+						|| message->FindFloat("deadzone", &deadzone) != B_OK
+						|| message->FindFloat("hysteresis", &hysteresis)
+							!= B_OK)
+					break;
+
+				UISDevice *device = _AcquireDevice(id);
+				if (device == NULL)
+					break;
+				DeviceReference reference(device);
+				UISReport *report = device->ReportAt(type, reportIndex);
+				if (report == NULL)
+					break;
+				status = report->SetItemFilter(itemIndex, deadzone,
+					hysteresis);
+				if (status == B_OK && device->VendorId() != 0) {
+					if (fFilterSettings.Set(device->VendorId(),
+							device->ProductId(), report->Id(), itemIndex,
+							deadzone, hysteresis) != B_OK)
+						TRACE("filter of %s not kept across restarts\n",
+							device->Name());
+				}
+				return status;
+			}
+
+		case B_UIS_ITEM_GET_FILTER:
+			{
+				uis_device_id id;
+				uint8 type;
+				int32 reportIndex, itemIndex;
+				if (message->FindInt32("device", &id) != B_OK
+						|| message->FindInt8("type", (int8 *) &type) != B_OK
+						|| message->FindInt32("report", &reportIndex) != B_OK
+						|| message->FindInt32("item", &itemIndex) != B_OK)
+					break;
+
+				UISDevice *device = _AcquireDevice(id);
+				if (device == NULL)
+					break;
+				DeviceReference reference(device);
+				UISReport *report = device->ReportAt(type, reportIndex);
+				if (report == NULL)
+					break;
+				float deadzone, hysteresis;
+				status = report->GetItemFilter(itemIndex, &deadzone,
+					&hysteresis);
+				if (status == B_OK)
+					status = reply->AddFloat("deadzone", deadzone);
+				if (status == B_OK)
+					status = reply->AddFloat("hysteresis", hysteresis);
+				return status;
+			}
 	}
 
 	return status;
@@ -444,25 +1340,107 @@ UISManager::HandleMessage(BMessage *message, BMessage *reply)
 
 
 void
-UISManager::RemoveDevice(uis_device_id id)
+UISManager::RemoveDevice(uis_device_id id, UISDevice *expected)
 {
-	BAutolock lock(fDeviceMapLock);
-	if (lock.IsLocked()) {
+	UISDevice *device = _AcquireDevice(id);
+	if (device == NULL)
+		return;
+	DeviceReference reference(device);
+	if (expected != NULL && device != expected)
+		return;
+			// already removed, and the id was reused
+	const char *name = device->Name();
+		// resolved before locking, as when the device was added
+
+	{
+		DeviceMapWriteLocker lock(fDeviceMapLock);
+		if (!lock.IsLocked())
+			return;
+
 		DeviceMap::iterator found = fDeviceMap.find(id);
-		if (found != fDeviceMap.end()) {
-			delete found->second;
-			fDeviceMap.erase(found);
-			fFreeDeviceIds++;
+		if (found == fDeviceMap.end() || found->second != device)
+			return;
+		fDeviceMap.erase(found);
+		_RemoveFromIndices(device, name);
+		fDeviceIds.Free(id);
+	}
+
+	UIS_TRACE_INSTANT(UIS_TRACE_DEVICE_REMOVE, id, 0);
+	fRecorder.RemoveDevice(id);
+	_NotifyWatchers(B_UIS_DEVICE_REMOVED, device);
+
+	device->ReleaseReference();
+		// requests still using the device keep it alive until they're done
+}
+
+
+/*!	Adds a device without a driver for UISReplayer. The device is returned
+	with a reference acquired for the replayer.
+*/
+UISDevice *
+UISManager::AddReplayDevice(const char *path, const char *name,
+	const uis_layout_info *layout)
+{
+	uis_device_id id;
+	{
+		DeviceMapWriteLocker lock(fDeviceMapLock);
+		if (!lock.IsLocked() || fPathIndex.ContainsKey(HashString(path)))
+			return NULL;
+
+		id = fDeviceIds.Allocate();
+		if (id < 0)
+			return NULL;
+	}
+
+	UISDevice *device = new (std::nothrow) UISDevice(id, this, path, name,
+		layout);
+	bool added = false;
+	if (device != NULL && device->InitCheck() == B_OK) {
+		DeviceMapWriteLocker lock(fDeviceMapLock);
+		if (lock.IsLocked()) {
+			try {
+				fDeviceMap.insert(std::make_pair(id, device));
+				if (_AddToIndices(device, device->Name()) == B_OK) {
+					device->AcquireReference();
+						// one for the map, one for the replayer
+					added = true;
+				} else
+					fDeviceMap.erase(id);
+			} catch (...) {}
 		}
 	}
+
+	if (!added) {
+		DeviceMapWriteLocker lock(fDeviceMapLock);
+		if (lock.IsLocked())
+			fDeviceIds.Free(id);
+		if (device != NULL)
+			device->ReleaseReference();
+		return NULL;
+	}
+
+	UIS_TRACE_INSTANT(UIS_TRACE_DEVICE_ADD, id, 0);
+	_NotifyWatchers(B_UIS_DEVICE_ADDED, device);
+	return device;
 }
 
 
+/*!	Looks up a device and returns it with a reference acquired, so that the
+	device map lock only needs to be held for the lookup itself.
+*/
 UISDevice *
-UISManager::_Device(uis_device_id id)
+UISManager::_AcquireDevice(uis_device_id id)
 {
+	DeviceMapReadLocker lock(fDeviceMapLock);
+	if (!lock.IsLocked())
+		return NULL;
+
 	DeviceMap::iterator found = fDeviceMap.find(id);
-	return (found != fDeviceMap.end()) ? found->second : NULL;
+	if (found == fDeviceMap.end())
+		return NULL;
+
+	found->second->AcquireReference();
+	return found->second;
 }
 
 
@@ -504,24 +1482,81 @@ UISManager::RemoveTarget(UISTarget *target)
 }
 
 
+void
+UISManager::_NotifyWatchers(int32 opcode, UISDevice *device)
+{
+	BMessage message(B_UIS_DEVICE_EVENT);
+	message.AddInt32("opcode", opcode);
+	message.AddInt32("device", device->Id());
+	message.AddInt16("page", device->UsagePage());
+	message.AddInt16("id", device->UsageId());
+	const char *name = device->Name();
+	if (name != NULL)
+		message.AddString("name", name);
+
+	// the watchers are sent to without holding the target list lock, that
+	// would hold up the event delivery
+	BList watchers;
+	{
+		BAutolock lock(fTargetListLocker);
+		if (!lock.IsLocked() || !watchers.AddList(&fWatcherList))
+			return;
+		for (int32 i = 0; i < watchers.CountItems(); i++)
+			((UISTarget *) watchers.ItemAt(i))->IncRef();
+	}
+
+	for (int32 i = 0; i < watchers.CountItems(); i++) {
+		UISTarget *target = (UISTarget *) watchers.ItemAt(i);
+		status_t status = target->SendMessage(&message, (BHandler *) NULL, 0);
+		if (status == B_BAD_PORT_ID) {
+			BAutolock lock(fTargetListLocker);
+			if (lock.IsLocked() && fWatcherList.RemoveItem(target))
+				RemoveTarget(target);
+		} else if (status != B_OK)
+			TRACE("watcher port full, device event dropped\n");
+
+		RemoveTarget(target);
+	}
+}
+
+
+/*!	Queues the event for the delivery thread, which sends it once dueTime
+	has come.
+*/
 status_t
-UISManager::SendEvent(uis_item_target *itemTarget, UISReportItem *item)
+UISManager::SendEvent(uis_item_target *itemTarget, UISReportItem *item,
+	float value, bigtime_t dueTime)
 {
 	UISTarget *target = itemTarget->target;
 
 	BAutolock lock(fTargetListLocker);
-	if (lock.IsLocked() && fTargetList.HasItem(target)) {
-		BMessage message(B_UIS_ITEM_EVENT);
-		message.AddPointer("cookie", itemTarget->cookie);
-		message.AddFloat("value", item->Value());
+	if (!lock.IsLocked() || !fTargetList.HasItem(target))
+		return B_ERROR;
 
-		status_t status = target->SendMessage(&message);
-		//TRACE("send msg status = %08x\n", status);
+	if (target->IsGone()) {
+		RemoveTarget(target);
+		return B_BAD_PORT_ID;
+	}
+
+	bool wakeUp;
+	status_t status = target->QueueEvent(itemTarget->serial,
+		itemTarget->cookie, value, item->DeliveryMode(),
+		item->Report()->ReportTime(), dueTime, &wakeUp);
+	if (status != B_OK)
+		return status;
+
+	if (fDeliverySem < 0) {
+		bigtime_t nextDue;
+		status = target->DeliverEvents(&fDeliveryLatency, &fTotalLatency,
+			&nextDue);
+			// no delivery thread, but still don't block; held back events
+			// go out with a later event
 		if (status == B_BAD_PORT_ID)
 			RemoveTarget(target);
-
-		return status;		
+		return status;
 	}
 
-	return B_ERROR;
+	if (wakeUp)
+		release_sem_etc(fDeliverySem, 1, B_DO_NOT_RESCHEDULE);
+	return B_OK;
 }
@@ -3,11 +3,21 @@
 
 #include <map>
 
+#include <AutoLocker.h>
+#include <HashMap.h>
+#include <HashString.h>
 #include <Looper.h>
 #include <List.h>
 #include <Locker.h>
+#include <RWLocker.h>
+#include <String.h>
 #include <UISKit.h>
 
+#include "UISDeviceIdAllocator.h"
+#include "UISFilterSettings.h"
+#include "UISLatency.h"
+#include "UISRecorder.h"
+
 struct _uis_item_target;
 typedef _uis_item_target uis_item_target;
 
@@ -16,6 +26,11 @@ class UISReportItem;
 class UISReport;
 class UISDevice;
 
+typedef AutoLocker<RWLocker, AutoLockerReadLocking<RWLocker> >
+	DeviceMapReadLocker;
+typedef AutoLocker<RWLocker, AutoLockerWriteLocking<RWLocker> >
+	DeviceMapWriteLocker;
+
 
 class UISManager : public BLooper {
 public:
@@ -28,28 +43,89 @@ public:
 	void			MessageReceived(BMessage *message);
 	status_t		HandleMessage(BMessage *message, BMessage *reply);
 
-	void			RemoveDevice(uis_device_id id);
+	port_id			RequestPort() const { return fRequestPort; };
+
+	void			RemoveDevice(uis_device_id id,
+						UISDevice *expected = NULL);
+	UISDevice *		AddReplayDevice(const char *path, const char *name,
+						const uis_layout_info *layout);
+	UISRecorder &	Recorder() { return fRecorder; };
 
 	UISTarget *		FindOrAddTarget(team_id team, port_id port, int32 token);
 	void			RemoveTarget(UISTarget *target);
-	status_t		SendEvent(uis_item_target *itemTarget, UISReportItem *item);
+	status_t		SendEvent(uis_item_target *itemTarget, UISReportItem *item,
+						float value, bigtime_t dueTime);
 
 private:
+	status_t		_StartWorkers();
+	void			_StopWorkers();
+	static status_t	_WorkerThreadEntry(void *arg);
+	void			_WorkerThread();
+
+	status_t		_StartBringUp();
+	void			_StopBringUp();
+	static status_t	_BringUpThreadEntry(void *arg);
+	void			_BringUpThread();
+	void			_BringUpDevice(uis_device_id id, const char *path);
+
+	status_t		_StartDelivery();
+	void			_StopDelivery();
+	static status_t	_DeliveryThreadEntry(void *arg);
+	void			_DeliveryThread();
+
 	void			_RecursiveScan(const char *directory);
 	void			_AddDevice(const char *path);
 	void			_HandleAddDevice(BMessage *message);
-	UISDevice *		_Device(uis_device_id id);
+	status_t		_AddToIndices(UISDevice *device, const char *name);
+	void			_RemoveFromIndices(UISDevice *device, const char *name);
+	void			_NotifyWatchers(int32 opcode, UISDevice *device);
+	UISDevice *		_AcquireDevice(uis_device_id id);
 
 	bool			fIsRunning;
 
+	port_id			fRequestPort;
+	thread_id *		fWorkerThreads;
+	int32			fWorkerCount;
+	BLocker			fRequestPortLock;
+
+	port_id			fBringUpPort;
+	thread_id *		fBringUpThreads;
+	int32			fBringUpCount;
+	int32			fPendingBringUps;
+	bigtime_t		fBringUpStart;
+
+	sem_id			fDeliverySem;
+	thread_id		fDeliveryThread;
+
 	typedef std::map<uis_device_id, UISDevice *> DeviceMap;
 	DeviceMap		fDeviceMap;
-	uis_device_id	fNextDeviceId;
-	int32			fFreeDeviceIds;
-	BLocker			fDeviceMapLock;
+	UISDeviceIdAllocator fDeviceIds;
+
+	typedef HashMap<HashString, uis_device_id> DeviceIndex;
+	DeviceIndex		fPathIndex;
+	struct NameLink {
+		uis_device_id	id;
+		NameLink *		next;
+	};
+	typedef HashMap<HashString, NameLink *> NameIndex;
+	NameIndex		fNameIndex;
+		// chains of the devices of the same name, in the order they were
+		// added
+	RWLocker		fDeviceMapLock;
+		// read locked by the lookups, write locked to add or remove devices
 
 	BList			fTargetList;
+	BList			fWatcherList;
 	BLocker			fTargetListLocker;
+
+	UISLatencyHistogram	fDeliveryLatency;
+		// events queued -> message sent to the target
+	UISLatencyHistogram	fTotalLatency;
+		// report came in -> message sent to the target
+
+	UISRecorder		fRecorder;
+	UISReplayer		fReplayer;
+	UISFilterSettings	fFilterSettings;
 };
 
 
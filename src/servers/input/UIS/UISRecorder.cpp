@@ -0,0 +1,586 @@
+#include "UISRecorder.h"
+#include "UISManager.h"
+#include "UISDevice.h"
+#include "UISReport.h"
+#include "UISItem.h"
+
+#include <Autolock.h>
+#include <StorageDefs.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+using std::nothrow;
+
+#include "UIS_debug.h"
+
+
+static const int32 kReplayThreadPriority = B_FIRST_REAL_TIME_PRIORITY + 4;
+	// same as the report readers it stands in for
+static const bigtime_t kReplayMaxSnooze = 100000;
+
+
+UISRecorder::UISRecorder()
+	:
+	fLock("uis recorder"),
+	fFile(NULL),
+	fLastTime(0)
+{
+}
+
+
+UISRecorder::~UISRecorder()
+{
+	Stop();
+}
+
+
+status_t
+UISRecorder::Start(const char *path)
+{
+	BAutolock lock(fLock);
+	if (!lock.IsLocked())
+		return B_ERROR;
+	if (fFile != NULL)
+		return B_BUSY;
+
+	FILE *file = fopen(path, "wb");
+	if (file == NULL)
+		return B_ERROR;
+
+	uis_log_header header;
+	header.magic = UIS_LOG_MAGIC;
+	header.version = UIS_LOG_VERSION;
+	header.start = system_time();
+	if (fwrite(&header, sizeof(header), 1, file) != 1) {
+		fclose(file);
+		return B_IO_ERROR;
+	}
+
+	fLastTime = 0;
+	fDevices.clear();
+	fFile = file;
+	return B_OK;
+}
+
+
+void
+UISRecorder::Stop()
+{
+	BAutolock lock(fLock);
+	if (!lock.IsLocked() || fFile == NULL)
+		return;
+
+	fclose(fFile);
+	fFile = NULL;
+	fDevices.clear();
+}
+
+
+/*!	Called by the report reader threads for every report they read, while
+	recording. The layout of a device is written along with its first report.
+*/
+void
+UISRecorder::RecordReport(UISReport *report, const uis_report_data *data)
+{
+	BAutolock lock(fLock);
+	if (!lock.IsLocked() || fFile == NULL)
+		return;
+
+	UISDevice *device = report->Device();
+	if (fDevices.find(device->Id()) == fDevices.end()
+		&& _WriteDevice(device) != B_OK) {
+		TRACE("writing the device layout failed, recording stopped\n");
+		fclose(fFile);
+		fFile = NULL;
+		return;
+	}
+
+	bigtime_t delta = 0;
+	if (fLastTime != 0 && data->timestamp > fLastTime)
+		delta = data->timestamp - fLastTime;
+	if (data->timestamp > fLastTime)
+		fLastTime = data->timestamp;
+			// readers of different devices may come in slightly out of order
+
+	uis_log_report record;
+	record.type = UIS_LOG_REPORT;
+	record.device = device->Id();
+	record.report = report->Index();
+	record.items = data->items;
+	record.delta = delta < 0xffffffff ? delta : 0xffffffff;
+
+	bool ok = fwrite(&record, sizeof(record), 1, fFile) == 1;
+	for (int32 i = 0; ok && i < data->items; i++) {
+		uis_log_value value;
+		value.index = data->item[i].index;
+		value.value = data->item[i].value;
+		ok = fwrite(&value, sizeof(value), 1, fFile) == 1;
+	}
+
+	if (!ok) {
+		TRACE("writing the recording failed, recording stopped\n");
+		fclose(fFile);
+		fFile = NULL;
+	}
+}
+
+
+void
+UISRecorder::RemoveDevice(uis_device_id id)
+{
+	BAutolock lock(fLock);
+	if (!lock.IsLocked() || fFile == NULL || fDevices.erase(id) == 0)
+		return;
+
+	uis_log_remove record;
+	record.type = UIS_LOG_REMOVE;
+	record.device = id;
+	fwrite(&record, sizeof(record), 1, fFile);
+}
+
+
+status_t
+UISRecorder::_WriteDevice(UISDevice *device)
+{
+	const char *name = device->Name();
+	if (name == NULL)
+		name = "";
+
+	uis_log_device record;
+	record.type = UIS_LOG_DEVICE;
+	record.device = device->Id();
+	record.usagePage = device->UsagePage();
+	record.usageId = device->UsageId();
+	record.reportCount = device->CountReports(UIS_REPORT_TYPE_INPUT);
+	record.nameLength = strlen(name);
+	if (fwrite(&record, sizeof(record), 1, fFile) != 1
+		|| fwrite(name, 1, record.nameLength, fFile) != record.nameLength)
+		return B_IO_ERROR;
+
+	for (int32 i = 0; i < record.reportCount; i++) {
+		UISReport *report = device->ReportAt(UIS_REPORT_TYPE_INPUT, i);
+
+		uis_log_report_layout reportLayout;
+		reportLayout.id = report->Id();
+		reportLayout.itemCount = report->CountItems();
+		if (fwrite(&reportLayout, sizeof(reportLayout), 1, fFile) != 1)
+			return B_IO_ERROR;
+
+		for (int32 n = 0; n < reportLayout.itemCount; n++) {
+			UISReportItem *item = report->ItemAt(n);
+
+			uis_log_item itemLayout;
+			itemLayout.usagePage = item->UsagePage();
+			itemLayout.usageId = item->UsageId();
+			itemLayout.flags = (item->IsRelative() ? UIS_LOG_ITEM_RELATIVE : 0)
+				| (item->IsContinuous() ? UIS_LOG_ITEM_CONTINUOUS : 0);
+			if (fwrite(&itemLayout, sizeof(itemLayout), 1, fFile) != 1)
+				return B_IO_ERROR;
+		}
+	}
+
+	try {
+		fDevices.insert(device->Id());
+	} catch (...) {
+		return B_NO_MEMORY;
+	}
+	return B_OK;
+}
+
+
+//	#pragma mark -
+
+
+UISReplayer::UISReplayer(UISManager *manager)
+	:
+	fUISManager(manager),
+	fLock("uis replayer"),
+	fFile(NULL),
+	fSpeed(1.0f),
+	fThread(-1),
+	fQuit(false),
+	fStart(0),
+	fReports(0),
+	fElapsed(0),
+	fStatus(B_OK)
+{
+}
+
+
+UISReplayer::~UISReplayer()
+{
+	Stop();
+}
+
+
+/*!	Replays a recording on devices created from the recorded layouts, so
+	no physical device is needed. A speed of 2 replays twice as fast as
+	recorded, a speed of 0 as fast as the reports can be dispatched.
+*/
+status_t
+UISReplayer::Start(const char *path, float speed)
+{
+	BAutolock lock(fLock);
+	if (!lock.IsLocked())
+		return B_ERROR;
+
+	if (fThread >= 0) {
+		thread_info info;
+		if (get_thread_info(fThread, &info) == B_OK)
+			return B_BUSY;
+		wait_for_thread(fThread, NULL);
+		fThread = -1;
+	}
+
+	if (speed < 0)
+		return B_BAD_VALUE;
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return B_ENTRY_NOT_FOUND;
+
+	uis_log_header header;
+	if (fread(&header, sizeof(header), 1, file) != 1
+		|| header.magic != UIS_LOG_MAGIC
+		|| header.version != UIS_LOG_VERSION) {
+		fclose(file);
+		return B_BAD_DATA;
+	}
+
+	fFile = file;
+	fSpeed = speed;
+	fQuit = false;
+	fReports = 0;
+	fElapsed = 0;
+	fStatus = B_OK;
+
+	fThread = spawn_thread(_ThreadEntry, "uis replay", kReplayThreadPriority,
+		(void *) this);
+	if (fThread < B_OK) {
+		status_t status = fThread;
+		fclose(fFile);
+		fFile = NULL;
+		fThread = -1;
+		return status;
+	}
+
+	return resume_thread(fThread);
+}
+
+
+void
+UISReplayer::Stop()
+{
+	fQuit = true;
+	Wait(NULL, NULL);
+}
+
+
+/*!	Waits for the replay to end, and returns how many reports it replayed
+	in how much time.
+*/
+status_t
+UISReplayer::Wait(int32 *reports, bigtime_t *elapsed)
+{
+	thread_id thread;
+	{
+		BAutolock lock(fLock);
+		if (!lock.IsLocked())
+			return B_ERROR;
+		thread = fThread;
+	}
+
+	if (thread >= 0)
+		wait_for_thread(thread, NULL);
+
+	BAutolock lock(fLock);
+	if (!lock.IsLocked())
+		return B_ERROR;
+	if (fThread == thread)
+		fThread = -1;
+
+	if (reports != NULL)
+		*reports = fReports;
+	if (elapsed != NULL)
+		*elapsed = fElapsed;
+	return fStatus;
+}
+
+
+status_t
+UISReplayer::_ThreadEntry(void *arg)
+{
+	((UISReplayer *) arg)->_Thread();
+	return B_OK;
+}
+
+
+void
+UISReplayer::_Thread()
+{
+	uint8 *buffer = NULL;
+	size_t bufferSize = 0;
+	bigtime_t logTime = 0;
+	status_t status = B_OK;
+
+	fStart = system_time();
+
+	while (!fQuit && status == B_OK) {
+		int type = fgetc(fFile);
+		if (type == EOF)
+			break;
+		ungetc(type, fFile);
+
+		switch (type) {
+			case UIS_LOG_DEVICE:
+				status = _ReadDevice();
+				break;
+
+			case UIS_LOG_REPORT:
+				status = _ReadReport(buffer, bufferSize, logTime);
+				break;
+
+			case UIS_LOG_REMOVE:
+			{
+				uis_log_remove record;
+				if (fread(&record, sizeof(record), 1, fFile) != 1) {
+					status = B_BAD_DATA;
+					break;
+				}
+
+				DeviceMap::iterator found = fDevices.find(record.device);
+				if (found == fDevices.end())
+					break;
+				fUISManager->RemoveDevice(found->second->Id());
+				found->second->ReleaseReference();
+				fDevices.erase(found);
+				break;
+			}
+
+			default:
+				status = B_BAD_DATA;
+				break;
+		}
+	}
+
+	fElapsed = system_time() - fStart;
+	TRACE("replayed %ld reports in %lld us: %s\n", fReports, fElapsed,
+		strerror(status));
+
+	free(buffer);
+	_RemoveDevices();
+
+	BAutolock lock(fLock);
+	fclose(fFile);
+	fFile = NULL;
+	fStatus = status;
+}
+
+
+/*!	Reads a device record and adds a device with its layout. Items only
+	need a distinct non-NULL cookie and a range telling whether they are
+	continuous; without a driver nothing else of the layout is used.
+*/
+status_t
+UISReplayer::_ReadDevice()
+{
+	uis_log_device record;
+	if (fread(&record, sizeof(record), 1, fFile) != 1)
+		return B_BAD_DATA;
+
+	char *name = (char *) malloc(record.nameLength + 1);
+	if (name == NULL)
+		return B_NO_MEMORY;
+	if (fread(name, 1, record.nameLength, fFile) != record.nameLength) {
+		free(name);
+		return B_BAD_DATA;
+	}
+	name[record.nameLength] = '\0';
+
+	uis_report_layout *reports
+		= new (std::nothrow) uis_report_layout[record.reportCount];
+	if (reports == NULL) {
+		free(name);
+		return B_NO_MEMORY;
+	}
+
+	uis_log_item *items = NULL;
+	int32 itemCount = 0;
+	status_t status = B_OK;
+
+	for (int32 i = 0; i < record.reportCount && status == B_OK; i++) {
+		uis_log_report_layout reportLayout;
+		if (fread(&reportLayout, sizeof(reportLayout), 1, fFile) != 1) {
+			status = B_BAD_DATA;
+			break;
+		}
+
+		reports[i].report = NULL;
+		reports[i].type = UIS_REPORT_TYPE_INPUT;
+		reports[i].id = reportLayout.id;
+		reports[i].itemCount = reportLayout.itemCount;
+		reports[i].firstItem = itemCount;
+
+		uis_log_item *newItems = (uis_log_item *) realloc(items,
+			sizeof(uis_log_item) * (itemCount + reportLayout.itemCount));
+		if (newItems == NULL) {
+			status = B_NO_MEMORY;
+			break;
+		}
+		items = newItems;
+
+		if (fread(items + itemCount, sizeof(uis_log_item),
+				reportLayout.itemCount, fFile) != reportLayout.itemCount)
+			status = B_BAD_DATA;
+		itemCount += reportLayout.itemCount;
+	}
+
+	uis_layout_info *layout = NULL;
+	if (status == B_OK) {
+		size_t size = sizeof(uis_layout_info)
+			+ sizeof(uis_report_layout) * record.reportCount
+			+ sizeof(uis_item_layout) * itemCount;
+		layout = (uis_layout_info *) malloc(size);
+		if (layout == NULL)
+			status = B_NO_MEMORY;
+		else {
+			layout->size = size;
+			layout->usage.page = record.usagePage;
+			layout->usage.id = record.usageId;
+			layout->reportCount[UIS_REPORT_TYPE_INPUT] = record.reportCount;
+			layout->reportCount[UIS_REPORT_TYPE_OUTPUT] = 0;
+			layout->reportCount[UIS_REPORT_TYPE_FEATURE] = 0;
+			layout->name = 0;
+			layout->itemCount = itemCount;
+			layout->vendor = 0;
+			layout->product = 0;
+
+			memcpy(layout + 1, reports,
+				sizeof(uis_report_layout) * record.reportCount);
+			uis_item_layout *itemLayouts = (uis_item_layout *)
+				((uis_report_layout *) (layout + 1) + record.reportCount);
+			for (int32 i = 0; i < itemCount; i++) {
+				itemLayouts[i].item = (void *) (addr_t) (i + 1);
+				itemLayouts[i].usage.page = items[i].usagePage;
+				itemLayouts[i].usage.id = items[i].usageId;
+				itemLayouts[i].flags
+					= (items[i].flags & UIS_LOG_ITEM_RELATIVE) != 0
+						? UIS_ITEM_RELATIVE : 0;
+				itemLayouts[i].minimum = 0;
+				itemLayouts[i].maximum
+					= (items[i].flags & UIS_LOG_ITEM_CONTINUOUS) != 0 ? 2 : 1;
+			}
+		}
+	}
+
+	delete [] reports;
+	free(items);
+
+	if (status != B_OK) {
+		free(name);
+		return status;
+	}
+
+	DeviceMap::iterator found = fDevices.find(record.device);
+	if (found != fDevices.end()) {
+		// the recorded id was reused without a remove record in between,
+		// the old device has to go first as it has the same path
+		fUISManager->RemoveDevice(found->second->Id());
+		found->second->ReleaseReference();
+		fDevices.erase(found);
+	}
+
+	char path[B_PATH_NAME_LENGTH];
+	snprintf(path, sizeof(path), "replay/%ld", record.device);
+
+	UISDevice *device = fUISManager->AddReplayDevice(path, name, layout);
+	free(layout);
+	free(name);
+	if (device == NULL)
+		return B_NO_MEMORY;
+
+	try {
+		fDevices.insert(std::make_pair(record.device, device));
+	} catch (...) {
+		fUISManager->RemoveDevice(device->Id());
+		device->ReleaseReference();
+		return B_NO_MEMORY;
+	}
+
+	return B_OK;
+}
+
+
+status_t
+UISReplayer::_ReadReport(uint8 *&buffer, size_t &bufferSize,
+	bigtime_t &logTime)
+{
+	uis_log_report record;
+	if (fread(&record, sizeof(record), 1, fFile) != 1)
+		return B_BAD_DATA;
+
+	size_t size = sizeof(uis_report_data)
+		+ sizeof(uis_item_data) * record.items;
+	if (size > bufferSize) {
+		uint8 *newBuffer = (uint8 *) realloc(buffer, size);
+		if (newBuffer == NULL)
+			return B_NO_MEMORY;
+		buffer = newBuffer;
+		bufferSize = size;
+	}
+
+	uis_report_data *data = (uis_report_data *) buffer;
+	data->items = record.items;
+	for (int32 i = 0; i < record.items; i++) {
+		uis_log_value value;
+		if (fread(&value, sizeof(value), 1, fFile) != 1)
+			return B_BAD_DATA;
+		data->item[i].index = value.index;
+		data->item[i].value = value.value;
+	}
+
+	logTime += record.delta;
+	if (fSpeed > 0) {
+		bigtime_t due = fStart + (bigtime_t) (logTime / fSpeed);
+		while (!fQuit) {
+			bigtime_t wait = due - system_time();
+			if (wait <= 0)
+				break;
+			snooze(wait < kReplayMaxSnooze ? wait : kReplayMaxSnooze);
+				// stays responsive to Stop() during long pauses
+		}
+	}
+
+	DeviceMap::iterator found = fDevices.find(record.device);
+	if (found == fDevices.end())
+		return B_OK;
+
+	UISDevice *device = found->second;
+	UISReport *report = device->ReportAt(UIS_REPORT_TYPE_INPUT, record.report);
+	if (report == NULL)
+		return B_OK;
+
+	bigtime_t now = system_time();
+	data->report = report->Report();
+	data->timestamp = now;
+	data->written = now;
+	report->SetReport(data);
+	device->DispatchLatency().Record(system_time() - now);
+
+	fReports++;
+	return B_OK;
+}
+
+
+void
+UISReplayer::_RemoveDevices()
+{
+	for (DeviceMap::iterator it = fDevices.begin(); it != fDevices.end();
+			it++) {
+		fUISManager->RemoveDevice(it->second->Id());
+		it->second->ReleaseReference();
+	}
+	fDevices.clear();
+}
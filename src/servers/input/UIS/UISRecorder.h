@@ -0,0 +1,143 @@
+#ifndef _UIS_RECORDER_H
+#define _UIS_RECORDER_H
+
+#include <map>
+#include <set>
+#include <stdio.h>
+
+#include <Locker.h>
+#include <UISKit.h>
+
+#include <uis_driver.h>
+
+
+class UISManager;
+class UISReport;
+class UISDevice;
+
+
+// A recording starts with a uis_log_header, followed by records that each
+// start with their uis_log_record type. Only input reports are recorded.
+//   UIS_LOG_DEVICE	uis_log_device, the name, then per report a
+//					uis_log_report_layout followed by its uis_log_items
+//   UIS_LOG_REPORT	uis_log_report followed by its uis_log_values
+//   UIS_LOG_REMOVE	uis_log_remove
+#define UIS_LOG_MAGIC		'UISR'
+#define UIS_LOG_VERSION		2
+
+enum {
+	UIS_LOG_DEVICE = 1,
+	UIS_LOG_REPORT,
+	UIS_LOG_REMOVE,
+};
+
+enum {
+	UIS_LOG_ITEM_RELATIVE	= 0x01,
+	UIS_LOG_ITEM_CONTINUOUS	= 0x02,
+};
+
+typedef struct {
+	uint32		magic;
+	uint32		version;
+	bigtime_t	start;
+} _PACKED uis_log_header;
+
+typedef struct {
+	uint8		type;
+	int32		device;
+	uint16		usagePage;
+	uint16		usageId;
+	uint16		reportCount;
+	uint16		nameLength;
+} _PACKED uis_log_device;
+
+typedef struct {
+	uint8		id;
+	uint16		itemCount;
+} _PACKED uis_log_report_layout;
+
+typedef struct {
+	uint16		usagePage;
+	uint16		usageId;
+	uint8		flags;
+} _PACKED uis_log_item;
+
+typedef struct {
+	uint8		type;
+	int32		device;
+	uint16		report;
+	uint16		items;
+	uint32		delta;
+		// microseconds since the previous report
+} _PACKED uis_log_report;
+
+typedef struct {
+	uint16		index;
+	float		value;
+} _PACKED uis_log_value;
+
+typedef struct {
+	uint8		type;
+	int32		device;
+} _PACKED uis_log_remove;
+
+
+class UISRecorder {
+public:
+					UISRecorder();
+					~UISRecorder();
+
+	status_t		Start(const char *path);
+	void			Stop();
+	bool			IsRecording() const { return fFile != NULL; };
+
+	void			RecordReport(UISReport *report,
+						const uis_report_data *data);
+	void			RemoveDevice(uis_device_id id);
+
+private:
+	status_t		_WriteDevice(UISDevice *device);
+
+	BLocker			fLock;
+	FILE *			fFile;
+	bigtime_t		fLastTime;
+	std::set<uis_device_id> fDevices;
+		// devices whose layout is in the recording
+};
+
+
+class UISReplayer {
+public:
+					UISReplayer(UISManager *manager);
+					~UISReplayer();
+
+	status_t		Start(const char *path, float speed);
+	void			Stop();
+	status_t		Wait(int32 *reports, bigtime_t *elapsed);
+
+private:
+	static status_t	_ThreadEntry(void *arg);
+	void			_Thread();
+	status_t		_ReadDevice();
+	status_t		_ReadReport(uint8 *&buffer, size_t &bufferSize,
+						bigtime_t &logTime);
+	void			_RemoveDevices();
+
+	UISManager *	fUISManager;
+	BLocker			fLock;
+	FILE *			fFile;
+	float			fSpeed;
+	thread_id		fThread;
+	volatile bool	fQuit;
+	bigtime_t		fStart;
+	int32			fReports;
+	bigtime_t		fElapsed;
+	status_t		fStatus;
+
+	typedef std::map<int32, UISDevice *> DeviceMap;
+	DeviceMap		fDevices;
+		// recorded device id -> replayed device
+};
+
+
+#endif // _UIS_RECORDER_H
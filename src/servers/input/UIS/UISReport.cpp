@@ -1,12 +1,19 @@
 #include "UISReport.h"
 #include "UISDevice.h"
 #include "UISItem.h"
+#include "UISDeviceIO.h"
+#include "UISManager.h"
+#include "UISRecorder.h"
+#include "UISTrace.h"
 
 #include <uis_driver.h>
 #include <UISProtocol.h>
 
+#include <Autolock.h>
+
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <new>
 
@@ -24,17 +31,20 @@ UISReport::UISReport(int fd, UISDevice *device, uint8 type, uint8 index)
 	fDevice(fd),
 	fUISDevice(device),
 	fType(type),
+	fIndex(index),
 	fReport(NULL),
 	fId(0),
+	fReportTime(0),
 	fReadingThread(-1),
 	fThreadActive(false),
 	fItems(NULL),
-	fItemsCount(0)
+	fItemsCount(0),
+	fInterestLock("uis report interest")
 {
 	uis_report_info reportDesc;
 	reportDesc.in.type = type;
 	reportDesc.in.index = index;
-	fStatus = ioctl(fd, UIS_REPORT_INFO, &reportDesc);
+	fStatus = uis_ioctl(fd, UIS_REPORT_INFO, &reportDesc);
 	if (fStatus != B_OK)
 		return;
 	fReport = reportDesc.out.report;
@@ -56,22 +66,43 @@ UISReport::UISReport(int fd, UISDevice *device, uint8 type, uint8 index)
 		fItems[fItemsCount++] = item;
 	}
 
-	char threadName[B_OS_NAME_LENGTH];
-	snprintf(threadName, B_OS_NAME_LENGTH, "uis report %08x reader",
-		(unsigned int) this);
-		// FIXME: fix the name of the thread
-	fReadingThread = spawn_thread(_ReadingThreadEntry, threadName,
-		kReportThreadPriority, (void *) this);
+	fStatus = B_OK;
+}
+
 
-	if (fReadingThread < B_OK) {
-		fStatus = fReadingThread;
+UISReport::UISReport(int fd, UISDevice *device, int32 index,
+	const uis_report_layout *layout, const uis_item_layout *items)
+	:
+	fStatus(B_NO_INIT),
+	fDevice(fd),
+	fUISDevice(device),
+	fType(layout->type),
+	fIndex(index),
+	fReport(layout->report),
+	fId(layout->id),
+	fReportTime(0),
+	fReadingThread(-1),
+	fThreadActive(false),
+	fItems(NULL),
+	fItemsCount(0),
+	fInterestLock("uis report interest")
+{
+	fItems = new (std::nothrow) UISReportItem *[layout->itemCount];
+	if (fItems == NULL)
 		return;
+	for (int32 n = 0 ; n < layout->itemCount; n++) {
+		UISReportItem *item = new (std::nothrow) UISReportItem(this,
+			&items[n]);
+		if (item == NULL)
+			break;
+		if (item->InitCheck() != B_OK) {
+			delete item;
+			break;
+		}
+		fItems[fItemsCount++] = item;
 	}
 
-	fThreadActive = true;
-	fStatus = resume_thread(fReadingThread);
-	if (fStatus != B_OK)
-		fThreadActive = false;
+	fStatus = B_OK;
 }
 
 
@@ -84,7 +115,7 @@ UISReport::~UISReport()
 		fThreadActive = false;
 			// this will eventually bring waiting thread down
 
-		if (ioctl(fDevice, UIS_STOP, &fReport) == B_OK) {
+		if (uis_ioctl(fDevice, UIS_STOP, &fReport) == B_OK) {
 			TRACE("wait for reading thread to quit...\n");
 			wait_for_thread(fReadingThread, NULL);
 				// wait only if ioctl succeeded, it'll eventually kill
@@ -101,6 +132,8 @@ UISReport::~UISReport()
 void
 UISReport::SetReport(uis_report_data *data)
 {
+	fReportTime = data->timestamp;
+
 	//TRACE("has items: %d\n", data->out.items);
 	for (int32 i = 0; i < data->items; i++) {
 		//TRACE("index of item: %d\n", data->out.item[i].index);
@@ -148,7 +181,7 @@ UISReport::SendReport(BMessage *message) const
 	}
 
 	if (status == B_OK)
-		status = ioctl(fDevice, UIS_SEND, buffer);
+		status = uis_ioctl(fDevice, UIS_SEND, buffer);
 
 	delete [] buffer;
 
@@ -156,6 +189,38 @@ UISReport::SendReport(BMessage *message) const
 }
 
 
+/*!	Starts the reader thread. This is separate from the construction, so
+	that the device is known to the manager before a reader may find it gone
+	and remove it. Replayed reports get their data from UISReplayer instead.
+*/
+status_t
+UISReport::StartReading()
+{
+	if (fDevice < 0 || fThreadActive)
+		return B_OK;
+
+	if (fType == UIS_REPORT_TYPE_INPUT)
+		UpdateInterest();
+			// targets may have been set before the reader started
+
+	char threadName[B_OS_NAME_LENGTH];
+	snprintf(threadName, B_OS_NAME_LENGTH, "uis report %08x reader",
+		(unsigned int) this);
+		// FIXME: fix the name of the thread
+	fReadingThread = spawn_thread(_ReadingThreadEntry, threadName,
+		kReportThreadPriority, (void *) this);
+
+	if (fReadingThread < B_OK)
+		return fReadingThread;
+
+	fThreadActive = true;
+	status_t status = resume_thread(fReadingThread);
+	if (status != B_OK)
+		fThreadActive = false;
+	return status;
+}
+
+
 status_t
 UISReport::_ReadingThreadEntry(void *arg)
 {
@@ -168,6 +233,8 @@ void
 UISReport::_ReadingThread()
 {
 	TRACE("entering thread for report id: %d\n", fId);
+	uis_device_id device = fUISDevice->Id();
+	UIS_TRACE_INSTANT(UIS_TRACE_READER_START, device, fId);
 
 	uint8 *buffer = new (std::nothrow) uint8[sizeof(uis_report_data)
 			+ sizeof(uis_report_info) * CountItems()];
@@ -180,8 +247,11 @@ UISReport::_ReadingThread()
 	while (fThreadActive) {
 		uis_report_data *data = (uis_report_data *) buffer;
 		data->report = fReport;
-		if (ioctl(fDevice, UIS_READ, data) != B_OK) {
+		UIS_TRACE_BEGIN(UIS_TRACE_REPORT_READ, device, fId);
+		if (uis_ioctl(fDevice, UIS_READ, data) != B_OK) {
+			UIS_TRACE_END(UIS_TRACE_REPORT_READ, device, fId);
 			if (errno == B_DEV_NOT_READY) {
+				UIS_TRACE_INSTANT(UIS_TRACE_READER_STOP, device, fId);
 				delete [] buffer;
 				fThreadActive = false;
 				fUISDevice->Remove();
@@ -194,10 +264,105 @@ UISReport::_ReadingThread()
 			break;
 		}
 
+		UIS_TRACE_END(UIS_TRACE_REPORT_READ, device, fId);
+
+		bigtime_t readTime = system_time();
+		fUISDevice->DriverLatency().Record(data->written - data->timestamp);
+		fUISDevice->ReadLatency().Record(readTime - data->written);
+
+		UISRecorder &recorder = fUISDevice->Manager()->Recorder();
+		if (recorder.IsRecording())
+			recorder.RecordReport(this, data);
+
+		UIS_TRACE_BEGIN(UIS_TRACE_REPORT_DISPATCH, device, data->items);
 		SetReport(data);
+		UIS_TRACE_END(UIS_TRACE_REPORT_DISPATCH, device, data->items);
+		fUISDevice->DispatchLatency().Record(system_time() - readTime);
 	}
 
 	delete [] buffer;
 
+	UIS_TRACE_INSTANT(UIS_TRACE_READER_STOP, device, fId);
 	TRACE("leaving thread for report id: %d\n", fId);
 }
+
+
+status_t
+UISReport::GetItemValue(int32 index, float *value) const
+{
+	if (index < 0 || index >= CountItems())
+		return B_BAD_INDEX;
+
+	uis_item_value info;
+	info.report = fReport;
+	info.index = index;
+	if (uis_ioctl(fDevice, UIS_GET_VALUE, &info) != 0)
+		return errno;
+
+	*value = info.value;
+	return B_OK;
+}
+
+
+status_t
+UISReport::GetItemFilter(int32 index, float *deadzone, float *hysteresis)
+	const
+{
+	if (index < 0 || index >= CountItems())
+		return B_BAD_INDEX;
+
+	uis_item_filter filter;
+	filter.report = fReport;
+	filter.index = index;
+	if (uis_ioctl(fDevice, UIS_GET_FILTER, &filter) != 0)
+		return errno;
+
+	*deadzone = filter.deadzone;
+	*hysteresis = filter.hysteresis;
+	return B_OK;
+}
+
+
+status_t
+UISReport::SetItemFilter(int32 index, float deadzone, float hysteresis) const
+{
+	if (index < -1 || index >= CountItems())
+		return B_BAD_INDEX;
+
+	uis_item_filter filter;
+	filter.report = fReport;
+	filter.index = index;
+	filter.deadzone = deadzone;
+	filter.hysteresis = hysteresis;
+	if (uis_ioctl(fDevice, UIS_SET_FILTER, &filter) != 0)
+		return errno;
+	return B_OK;
+}
+
+
+/*!	Tells the driver which items someone listens to or has polled, so that
+	it doesn't extract the others from the incoming reports at all.
+*/
+void
+UISReport::UpdateInterest()
+{
+	BAutolock _(fInterestLock);
+
+	uint8 *mask = (uint8 *) calloc((fItemsCount + 7) / 8, 1);
+	if (mask == NULL && fItemsCount > 0)
+		return;
+
+	for (int32 i = 0; i < fItemsCount; i++) {
+		if (fItems[i]->HasInterest())
+			mask[i / 8] |= 1 << (i % 8);
+	}
+
+	uis_interest_info info;
+	info.report = fReport;
+	info.count = fItemsCount;
+	info.mask = mask;
+	if (uis_ioctl(fDevice, UIS_SET_INTEREST, &info) != 0)
+		TRACE("setting the item interest failed: %s\n", strerror(errno));
+
+	free(mask);
+}
@@ -1,11 +1,11 @@
 #ifndef _UIS_REPORT_H
 #define _UIS_REPORT_H
 
+#include <Locker.h>
 #include <Message.h>
 
+#include <uis_driver.h>
 
-struct _uis_report_data;
-typedef _uis_report_data uis_report_data;
 
 class UISReportItem;
 class UISDevice;
@@ -14,17 +14,30 @@ class UISReport {
 public:
 					UISReport(int fd, UISDevice *device, uint8 type,
 						uint8 index);
+					UISReport(int fd, UISDevice *device, int32 index,
+						const uis_report_layout *layout,
+						const uis_item_layout *items);
 					~UISReport();
 
 	status_t		InitCheck() const { return fStatus; };
+	status_t		StartReading();
 	UISDevice *		Device() const { return fUISDevice; };
+	int32			Index() const { return fIndex; };
+	uint8			Id() const { return fId; };
 	void *			Report() const { return fReport; };
+	bigtime_t		ReportTime() const { return fReportTime; };
 
 	void			SetReport(uis_report_data *data);
 	int32			CountItems() const { return fItemsCount; };
 	UISReportItem *	ItemAt(int32 index) const;
 
 	status_t		SendReport(BMessage *message) const;
+	status_t		GetItemValue(int32 index, float *value) const;
+	status_t		GetItemFilter(int32 index, float *deadzone,
+						float *hysteresis) const;
+	status_t		SetItemFilter(int32 index, float deadzone,
+						float hysteresis) const;
+	void			UpdateInterest();
 
 private:
 	static status_t	_ReadingThreadEntry(void *arg);
@@ -34,12 +47,15 @@ private:
 	int				fDevice;
 	UISDevice *		fUISDevice;
 	uint8			fType;
+	int32			fIndex;
 	void *			fReport;
 	uint8			fId;
+	bigtime_t		fReportTime;
 	thread_id		fReadingThread;
 	volatile bool	fThreadActive;
 	UISReportItem **	fItems;
 	int32			fItemsCount;
+	BLocker			fInterestLock;
 };
 
 
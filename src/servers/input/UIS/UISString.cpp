@@ -1,4 +1,5 @@
 #include "UISString.h"
+#include "UISDeviceIO.h"
 
 #include <OS.h>
 #include <UTF8.h>
@@ -53,6 +54,15 @@ UISString::SetTo(int fd, uint32 id)
 }
 
 
+void
+UISString::SetTo(const char *string)
+{
+	free(fString);
+	fString = string != NULL ? StrDupTrim(string) : NULL;
+	fIsValid = true;
+}
+
+
 const char *
 UISString::String()
 {
@@ -65,13 +75,13 @@ UISString::String()
 	uis_string_info info;
 	info.id = fId;
 	info.string = NULL;
-	if (ioctl(fDevice, UIS_STRING_INFO, &info) != B_OK)
+	if (uis_ioctl(fDevice, UIS_STRING_INFO, &info) != B_OK)
 		return NULL;
 
 	info.string = new (std::nothrow) char[info.length];
 	if (info.string == NULL)
 		return NULL;
-	if (ioctl(fDevice, UIS_STRING_INFO, &info) != B_OK) {
+	if (uis_ioctl(fDevice, UIS_STRING_INFO, &info) != B_OK) {
 		delete [] info.string;
 		return NULL;
 	}
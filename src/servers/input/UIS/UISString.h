@@ -12,6 +12,7 @@ public:
 					~UISString();
 
 	void			SetTo(int fd, uint32 id);
+	void			SetTo(const char *string);
 	const char *	String();
 
 private:
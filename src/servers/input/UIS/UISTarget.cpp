@@ -1,16 +1,45 @@
 #include "UISTarget.h"
+#include "UISLatency.h"
+#include "UISTrace.h"
+
+#include <Autolock.h>
+#include <Message.h>
+
+#include <UISProtocol.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#include "UIS_debug.h"
+
+
+static const int32 kInitialQueuedEvents = 32;
 
 
 UISTarget::UISTarget(team_id team, port_id port, int32 token)
 	:
 	BMessenger(),
 	BMessenger::Private(this),
-	fRefCount(1)
+	fRefCount(1),
+	fQueueLock("uis target queue"),
+	fQueue((uis_target_event *) malloc(sizeof(uis_target_event)
+		* kInitialQueuedEvents)),
+	fQueueCount(0),
+	fQueueSize(fQueue != NULL ? kInitialQueuedEvents : 0),
+	fDroppedEvents(0),
+	fGone(false)
 {
 	SetTo(team, port, token);
 }
 
 
+UISTarget::~UISTarget()
+{
+	free(fQueue);
+}
+
+
 bool
 UISTarget::HasTarget(port_id port, int32 token)
 {
@@ -25,3 +54,144 @@ UISTarget::DecRef()
 		fRefCount--;
 	return fRefCount;
 }
+
+
+/*!	Queues an event for the delivery thread. Depending on the mode, the value
+	may be merged into an event that is still pending for the same key, which
+	keeps its times, so that latencies aren't underestimated.
+	Button events are never merged, the queue grows as needed to keep every
+	transition. As the other modes keep at most one event per key pending,
+	only the button events of a target that doesn't read its port make the
+	queue grow, at the rate the buttons are pressed. Only when memory runs
+	out is an event dropped, which is counted and traced.
+	The event isn't delivered before dueTime. wakeUp tells whether the
+	delivery thread has to be woken up, because nothing was due earlier.
+*/
+status_t
+UISTarget::QueueEvent(uint32 key, void *cookie, float value, uint32 mode,
+	bigtime_t reportTime, bigtime_t dueTime, bool *wakeUp)
+{
+	BAutolock lock(fQueueLock);
+	if (!lock.IsLocked())
+		return B_ERROR;
+
+	bigtime_t earliest = B_INFINITE_TIMEOUT;
+	for (int32 i = 0; i < fQueueCount; i++) {
+		if (fQueue[i].dueTime < earliest)
+			earliest = fQueue[i].dueTime;
+	}
+	*wakeUp = dueTime < earliest;
+
+	if (mode != UIS_DELIVER_QUEUE && _MergeEvent(key, value, mode, dueTime))
+		return B_OK;
+
+	if (fQueueCount >= fQueueSize) {
+		int32 size = fQueueSize > 0 ? fQueueSize * 2 : kInitialQueuedEvents;
+		uis_target_event *queue = (uis_target_event *) realloc(fQueue,
+			sizeof(uis_target_event) * size);
+		if (queue == NULL) {
+			UIS_TRACE_INSTANT(UIS_TRACE_EVENT_DROP, Port(), fDroppedEvents + 1);
+			if ((fDroppedEvents++ % 100) == 0)
+				TRACE("out of memory, dropped %ld events\n", fDroppedEvents);
+			return B_NO_MEMORY;
+		}
+		fQueue = queue;
+		fQueueSize = size;
+	}
+
+	fQueue[fQueueCount].key = key;
+	fQueue[fQueueCount].cookie = cookie;
+	fQueue[fQueueCount].value = value;
+	fQueue[fQueueCount].reportTime = reportTime;
+	fQueue[fQueueCount].queueTime = system_time();
+	fQueue[fQueueCount].dueTime = dueTime;
+	fQueueCount++;
+
+	UIS_TRACE_INSTANT(UIS_TRACE_EVENT_QUEUE, Port(), fQueueCount);
+	return B_OK;
+}
+
+
+/*!	Merges the value into the newest pending event of the key, if there is
+	one: relative values are summed up, others replace the pending value.
+	The merged event is due with the earlier of both.
+*/
+bool
+UISTarget::_MergeEvent(uint32 key, float value, uint32 mode,
+	bigtime_t dueTime)
+{
+	for (int32 i = fQueueCount - 1; i >= 0; i--) {
+		if (fQueue[i].key != key)
+			continue;
+		if (mode == UIS_DELIVER_ACCUMULATE)
+			fQueue[i].value += value;
+		else
+			fQueue[i].value = value;
+		if (dueTime < fQueue[i].dueTime)
+			fQueue[i].dueTime = dueTime;
+		return true;
+	}
+	return false;
+}
+
+
+/*!	Sends as many of the events that are due as the target port takes
+	without blocking. Returns B_WOULD_BLOCK if due events are left, because
+	the port is full, and sets nextDue to when the next of the other events
+	is due. The latency of an event held back by a rate limit is measured
+	from its due time, and isn't part of the total latency.
+*/
+status_t
+UISTarget::DeliverEvents(UISLatencyHistogram *deliveryLatency,
+	UISLatencyHistogram *totalLatency, bigtime_t *nextDue)
+{
+	*nextDue = B_INFINITE_TIMEOUT;
+
+	BAutolock lock(fQueueLock);
+	if (!lock.IsLocked())
+		return B_ERROR;
+
+	status_t status = B_OK;
+	bigtime_t now = system_time();
+	int32 kept = 0;
+
+	for (int32 i = 0; i < fQueueCount; i++) {
+		uis_target_event &event = fQueue[i];
+		if (status == B_OK && event.dueTime <= now) {
+			BMessage message(B_UIS_ITEM_EVENT);
+			message.AddPointer("cookie", event.cookie);
+			message.AddFloat("value", event.value);
+
+			status = SendMessage(&message, (BHandler *) NULL, 0);
+			if (status == B_OK) {
+				bigtime_t sent = system_time();
+				if (event.dueTime > event.queueTime)
+					deliveryLatency->Record(sent - event.dueTime);
+				else {
+					deliveryLatency->Record(sent - event.queueTime);
+					totalLatency->Record(sent - event.reportTime);
+				}
+				continue;
+			}
+		}
+
+		if (event.dueTime > now && event.dueTime < *nextDue)
+			*nextDue = event.dueTime;
+		if (kept != i)
+			fQueue[kept] = event;
+		kept++;
+	}
+
+	if (status == B_BAD_PORT_ID) {
+		fGone = true;
+		fQueueCount = 0;
+		*nextDue = B_INFINITE_TIMEOUT;
+		return status;
+	}
+
+	fQueueCount = kept;
+
+	if (status == B_TIMED_OUT)
+		status = B_WOULD_BLOCK;
+	return status;
+}
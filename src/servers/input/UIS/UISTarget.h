@@ -1,24 +1,68 @@
 #ifndef _UIS_TARGET_H
 #define _UIS_TARGET_H
 
+#include <Locker.h>
 #include <Messenger.h>
 #include <MessengerPrivate.h>
 
 using namespace BPrivate;
 
 
+enum {
+	UIS_DELIVER_QUEUE = 0,
+		// every event is delivered, e.g. buttons
+	UIS_DELIVER_LATEST,
+		// only the latest pending value is delivered, for absolute axes
+	UIS_DELIVER_ACCUMULATE,
+		// pending values are summed up, for relative items
+};
+
+
+typedef struct {
+	uint32			key;
+		// the serial of the subscription, never reused unlike its address
+	void *			cookie;
+	float			value;
+	bigtime_t		reportTime;
+	bigtime_t		queueTime;
+	bigtime_t		dueTime;
+		// later than queueTime for values held back by a rate limit
+} uis_target_event;
+
+
+class UISLatencyHistogram;
+
+
 class UISTarget : public BMessenger, public BMessenger::Private
 {
 public:
 			UISTarget(team_id team, port_id port, int32 token);
+			~UISTarget();
 
 	bool	HasTarget(port_id port, int32 token);
 
 	void	IncRef() { fRefCount++; };
 	uint32	DecRef();
 
+	status_t	QueueEvent(uint32 key, void *cookie, float value,
+					uint32 mode, bigtime_t reportTime, bigtime_t dueTime,
+					bool *wakeUp);
+	status_t	DeliverEvents(UISLatencyHistogram *deliveryLatency,
+					UISLatencyHistogram *totalLatency, bigtime_t *nextDue);
+	bool		IsGone() { return fGone; };
+
 private:
+	bool	_MergeEvent(uint32 key, float value, uint32 mode,
+				bigtime_t dueTime);
+
 	uint32	fRefCount;
+
+	BLocker	fQueueLock;
+	uis_target_event *fQueue;
+	int32	fQueueCount;
+	int32	fQueueSize;
+	int32	fDroppedEvents;
+	bool	fGone;
 };
 
 
@@ -0,0 +1,253 @@
+#include "UISTrace.h"
+
+#ifdef UIS_TRACE_RING
+
+#include <OS.h>
+#include <TLS.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+static const int32 kMaxTraceThreads = 256;
+	// the records of a ring are only allocated once it's claimed, so this
+	// covers the reader threads of a mock load without costing much
+static const uint32 kTraceRingSize = 4096;
+	// records per thread, must be a power of two
+
+
+struct uis_trace_record {
+	bigtime_t	time;
+	uint16		event;
+	char		phase;
+	int32		arg[2];
+};
+
+struct uis_trace_ring {
+	int32				owner;
+		// thread owning the ring, 0 if free
+	int32				head;
+		// records ever written, only advanced by the owner
+	uis_trace_record *	records;
+	char				name[B_OS_NAME_LENGTH];
+};
+
+struct uis_trace_event_info {
+	const char *		name;
+	const char *		arg[2];
+};
+
+
+static const uis_trace_event_info kEventInfo[UIS_TRACE_EVENTS] = {
+	{ "device add",			{ "device", NULL } },
+	{ "device remove",		{ "device", NULL } },
+	{ "reader start",		{ "device", "report" } },
+	{ "reader stop",		{ "device", "report" } },
+	{ "report read",		{ "device", "report" } },
+	{ "report dispatch",	{ "device", "items" } },
+	{ "event queue",		{ "port", "queued" } },
+	{ "event drop",			{ "port", "dropped" } },
+	{ "delivery",			{ "targets", "blocked" } },
+	{ "request",			{ "opcode", "status" } },
+};
+
+static int32 sTLSIndex = -1;
+static uis_trace_ring sRings[kMaxTraceThreads];
+static uis_trace_ring sNoRing;
+	// marks the threads that found no ring, they don't try again
+static int32 sUntracedThreads = 0;
+static int32 sLostRecords = 0;
+
+
+/*!	Hands a ring to the calling thread. Free rings are taken first, then
+	those of threads that are gone; the latter keep their records buffer.
+*/
+static uis_trace_ring *
+claim_ring()
+{
+	thread_info info;
+	if (get_thread_info(find_thread(NULL), &info) != B_OK)
+		return NULL;
+
+	uis_trace_ring *ring = NULL;
+	for (int32 i = 0; i < kMaxTraceThreads && ring == NULL; i++) {
+		if (atomic_test_and_set(&sRings[i].owner, info.thread, 0) == 0)
+			ring = &sRings[i];
+	}
+
+	for (int32 i = 0; i < kMaxTraceThreads && ring == NULL; i++) {
+		thread_info ownerInfo;
+		int32 owner = atomic_get(&sRings[i].owner);
+		if (owner == 0 || get_thread_info(owner, &ownerInfo) == B_OK)
+			continue;
+		if (atomic_test_and_set(&sRings[i].owner, info.thread, owner) == owner)
+			ring = &sRings[i];
+	}
+
+	if (ring == NULL)
+		return NULL;
+
+	if (ring->records == NULL) {
+		ring->records = (uis_trace_record *) malloc(
+			sizeof(uis_trace_record) * kTraceRingSize);
+		if (ring->records == NULL) {
+			atomic_set(&ring->owner, 0);
+			return NULL;
+		}
+	}
+
+	strlcpy(ring->name, info.name, sizeof(ring->name));
+	for (char *c = ring->name; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\')
+			*c = '_';
+				// keeps the JSON export simple
+	}
+	atomic_set(&ring->head, 0);
+	tls_set(sTLSIndex, ring);
+	return ring;
+}
+
+
+status_t
+uis_trace_init()
+{
+	if (sTLSIndex >= 0)
+		return B_OK;
+
+	sTLSIndex = tls_allocate();
+	return sTLSIndex >= 0 ? B_OK : B_NO_MEMORY;
+}
+
+
+void
+uis_trace(uint16 event, char phase, int32 arg0, int32 arg1)
+{
+	if (sTLSIndex < 0)
+		return;
+
+	uis_trace_ring *ring = (uis_trace_ring *) tls_get(sTLSIndex);
+	if (ring == NULL && (ring = claim_ring()) == NULL) {
+		atomic_add(&sUntracedThreads, 1);
+		tls_set(sTLSIndex, &sNoRing);
+		ring = &sNoRing;
+	}
+	if (ring == &sNoRing) {
+		atomic_add(&sLostRecords, 1);
+		return;
+	}
+
+	uint32 head = (uint32) ring->head;
+	uis_trace_record &record = ring->records[head & (kTraceRingSize - 1)];
+	record.time = system_time();
+	record.event = event;
+	record.phase = phase;
+	record.arg[0] = arg0;
+	record.arg[1] = arg1;
+
+	atomic_set(&ring->head, (int32) (head + 1));
+		// publishes the record to uis_trace_export()
+}
+
+
+static void
+export_record(FILE *file, team_id team, thread_id thread,
+	const uis_trace_record &record, bool &first)
+{
+	if (record.event >= UIS_TRACE_EVENTS)
+		return;
+
+	const uis_trace_event_info &info = kEventInfo[record.event];
+	fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lld,"
+		"\"pid\":%ld,\"tid\":%ld", first ? "" : ",", info.name, record.phase,
+		record.time, team, thread);
+	if (record.phase == 'i')
+		fputs(",\"s\":\"t\"", file);
+
+	fputs(",\"args\":{", file);
+	for (int32 i = 0; i < 2 && info.arg[i] != NULL; i++)
+		fprintf(file, "%s\"%s\":%ld", i > 0 ? "," : "", info.arg[i],
+			record.arg[i]);
+	fputs("}}", file);
+
+	first = false;
+}
+
+
+/*!	Returns how many threads found no free ring, and how many records they
+	tried to write since.
+*/
+void
+uis_trace_losses(int32 *threads, int32 *records)
+{
+	*threads = atomic_get(&sUntracedThreads);
+	*records = atomic_get(&sLostRecords);
+}
+
+
+/*!	Writes the records of all rings as Chrome trace event JSON. The rings
+	are copied while their threads keep writing; records that may have been
+	overwritten during the copy are left out.
+*/
+status_t
+uis_trace_export(const char *path)
+{
+	uis_trace_record *copy = (uis_trace_record *) malloc(
+		sizeof(uis_trace_record) * kTraceRingSize);
+	if (copy == NULL)
+		return B_NO_MEMORY;
+
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		free(copy);
+		return B_ERROR;
+	}
+
+	team_id team = getpid();
+	bool first = true;
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+
+	for (int32 i = 0; i < kMaxTraceThreads; i++) {
+		uis_trace_ring &ring = sRings[i];
+		thread_id thread = atomic_get(&ring.owner);
+		if (thread == 0 || ring.records == NULL)
+			continue;
+
+		uint32 head = (uint32) atomic_get(&ring.head);
+		uint32 count = head < kTraceRingSize ? head : kTraceRingSize;
+		uint32 start = head - count;
+		for (uint32 n = 0; n < count; n++)
+			copy[n] = ring.records[(start + n) & (kTraceRingSize - 1)];
+
+		// the owner may have lapped us while copying, and may be in the
+		// middle of writing the slot after the new head
+		uint32 newHead = (uint32) atomic_get(&ring.head);
+		uint32 skip = 0;
+		if (newHead - start + 1 > kTraceRingSize)
+			skip = newHead - start + 1 - kTraceRingSize;
+		if (skip > count)
+			skip = count;
+
+		fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\","
+			"\"pid\":%ld,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+			first ? "" : ",", team, thread, ring.name);
+		first = false;
+
+		for (uint32 n = skip; n < count; n++)
+			export_record(file, team, thread, copy[n], first);
+	}
+
+	// a truncated trace should not pass for a complete one
+	int32 threads, records;
+	uis_trace_losses(&threads, &records);
+	fprintf(file, "\n],\"otherData\":{\"untraced threads\":%ld,"
+		"\"lost records\":%ld}}\n", threads, records);
+	status_t status = ferror(file) ? B_IO_ERROR : B_OK;
+	fclose(file);
+	free(copy);
+	return status;
+}
+
+
+#endif // UIS_TRACE_RING
@@ -0,0 +1,53 @@
+#ifndef _UIS_TRACE_H
+#define _UIS_TRACE_H
+
+#include <SupportDefs.h>
+
+// Binary trace of the input path. Every thread writes fixed size records
+// into a ring of its own, so tracing takes neither a lock nor a syscall and
+// can stay enabled. uis_trace_export() writes the rings as Chrome trace
+// event JSON (chrome://tracing, Perfetto).
+#define UIS_TRACE_RING
+
+
+enum {
+	UIS_TRACE_DEVICE_ADD = 0,	// device id
+	UIS_TRACE_DEVICE_REMOVE,	// device id
+	UIS_TRACE_READER_START,		// device id, report id
+	UIS_TRACE_READER_STOP,		// device id, report id
+	UIS_TRACE_REPORT_READ,		// device id, report id
+	UIS_TRACE_REPORT_DISPATCH,	// device id, items
+	UIS_TRACE_EVENT_QUEUE,		// target port, queued events
+	UIS_TRACE_EVENT_DROP,		// target port, dropped events
+	UIS_TRACE_DELIVERY,			// targets, blocked
+	UIS_TRACE_REQUEST,			// opcode, status
+
+	UIS_TRACE_EVENTS
+};
+
+
+#ifdef UIS_TRACE_RING
+status_t	uis_trace_init();
+void		uis_trace(uint16 event, char phase, int32 arg0, int32 arg1);
+status_t	uis_trace_export(const char *path);
+void		uis_trace_losses(int32 *threads, int32 *records);
+
+#define UIS_TRACE_BEGIN(event, arg0, arg1) \
+	uis_trace(event, 'B', arg0, arg1)
+#define UIS_TRACE_END(event, arg0, arg1) \
+	uis_trace(event, 'E', arg0, arg1)
+#define UIS_TRACE_INSTANT(event, arg0, arg1) \
+	uis_trace(event, 'i', arg0, arg1)
+#else
+static inline status_t uis_trace_init() { return B_OK; }
+static inline status_t uis_trace_export(const char *) { return B_NOT_SUPPORTED; }
+static inline void uis_trace_losses(int32 *threads, int32 *records)
+	{ *threads = 0; *records = 0; }
+
+#define UIS_TRACE_BEGIN(event, arg0, arg1)
+#define UIS_TRACE_END(event, arg0, arg1)
+#define UIS_TRACE_INSTANT(event, arg0, arg1)
+#endif
+
+
+#endif // _UIS_TRACE_H
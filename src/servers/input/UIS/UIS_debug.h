@@ -1,7 +1,9 @@
 #ifndef _UIS_DEBUG_H
 #define _UIS_DEBUG_H
 
-#define TRACE_IS_UIS
+//#define TRACE_IS_UIS
+	// formatted logging to /var/log/uis_input_server.log, too slow to leave
+	// on; the input path is traced by UISTrace.h instead
 
 #undef TRACE
 #ifdef TRACE_IS_UIS
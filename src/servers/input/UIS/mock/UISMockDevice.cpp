@@ -0,0 +1,607 @@
+#include <uis_mock_device.h>
+#include <uis_driver.h>
+
+#include <Errors.h>
+#include <OS.h>
+#include <UTF8.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+
+static const char kMockPathPrefix[] = "/dev/input/uis_mock/";
+static const int kMockDescriptorBase = 0x40000000;
+	// far above any descriptor the process gets for real files
+static const int32 kMaxMockDevices = 16384;
+static const uint32 kNameId = 1;
+
+
+struct mock_item {
+	float		value;
+	float		reported;
+	float		deadzone;
+	float		hysteresis;
+	bool		interesting;
+};
+
+struct mock_device {
+	char				path[64];
+	char				name[32];
+	uis_mock_config		config;
+	int32				slot;
+
+	pthread_mutex_t		lock;
+	pthread_cond_t		condition;
+	bool				removed;
+	bool				stopRequested;
+	int32				openCount;
+
+	bigtime_t			nextReport;
+	uint32				sequence;
+	uint32				random;
+	mock_item *			items;
+	uis_report_stats	stats;
+};
+
+
+static pthread_mutex_t sDevicesLock = PTHREAD_MUTEX_INITIALIZER;
+static mock_device *sDevices[kMaxMockDevices];
+	// read without the lock by ioctl(), a device only goes away when it's
+	// closed, and nobody uses a descriptor after closing it
+static int32 sNextDevice;
+
+
+static mock_device *
+device_for_descriptor(int fd)
+{
+	int32 slot = fd - kMockDescriptorBase;
+	if (slot < 0 || slot >= kMaxMockDevices)
+		return NULL;
+	return sDevices[slot];
+}
+
+
+static int
+set_errno(status_t status)
+{
+	if (status == B_OK)
+		return 0;
+	errno = status;
+	return -1;
+}
+
+
+static void
+delete_device(mock_device *device)
+{
+	pthread_cond_destroy(&device->condition);
+	pthread_mutex_destroy(&device->lock);
+	free(device->items);
+	free(device);
+}
+
+
+static float
+next_random(mock_device *device)
+{
+	// xorshift, good enough for load and reproducible by seed
+	uint32 x = device->random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	device->random = x;
+	return (x & 0xffffff) / (float) 0x1000000;
+}
+
+
+/*!	Computes the item values of the next report. */
+static void
+generate_report(mock_device *device)
+{
+	const uis_mock_config &config = device->config;
+	uint32 sequence = device->sequence++;
+
+	for (int32 i = 0; i < config.itemCount; i++) {
+		mock_item &item = device->items[i];
+		switch (config.pattern) {
+			case UIS_MOCK_RAMP:
+				item.value = ((sequence + i * 7) % 200) / 100.0f - 1.0f;
+				break;
+
+			case UIS_MOCK_RANDOM:
+				if (next_random(device) < config.changeProbability)
+					item.value = next_random(device) * 2.0f - 1.0f;
+				else if (config.relative)
+					item.value = 0.0f;
+				break;
+
+			case UIS_MOCK_TOGGLE:
+				if ((int32) (sequence % config.itemCount) == i)
+					item.value = item.value != 0.0f ? 0.0f : 1.0f;
+				break;
+		}
+	}
+}
+
+
+/*!	Fills in the interesting items that changed, filtered the way the
+	usb_hid driver filters them. Returns the number of items.
+*/
+static int32
+extract_items(mock_device *device, uis_report_data *data)
+{
+	int32 count = 0;
+	for (int32 i = 0; i < device->config.itemCount; i++) {
+		mock_item &item = device->items[i];
+		if (!item.interesting)
+			continue;
+
+		float value = item.value;
+		if (device->config.relative) {
+			if (value == 0.0f)
+				continue;
+		} else {
+			if (fabsf(value) < item.deadzone)
+				value = 0.0f;
+			if (value == item.reported
+				|| fabsf(value - item.reported) < item.hysteresis)
+				continue;
+			item.reported = value;
+		}
+
+		data->item[count].index = i;
+		data->item[count].value = value;
+		count++;
+	}
+
+	return count;
+}
+
+
+static void
+wait_until(mock_device *device, bigtime_t due)
+{
+	bigtime_t timeout = due - system_time();
+	if (timeout <= 0)
+		return;
+
+	struct timespec until;
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += timeout / 1000000;
+	until.tv_nsec += (timeout % 1000000) * 1000;
+	if (until.tv_nsec >= 1000000000) {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000;
+	}
+
+	pthread_cond_timedwait(&device->condition, &device->lock, &until);
+}
+
+
+/*!	Blocks until the next report with changed interesting items is due,
+	like UIS_READ on the usb_hid driver. Reports that are due while nobody
+	reads are missed, as with a real device.
+*/
+static status_t
+read_report(mock_device *device, uis_report_data *data)
+{
+	pthread_mutex_lock(&device->lock);
+	device->stats.wakeups++;
+
+	status_t status = B_OK;
+	while (true) {
+		if (device->removed) {
+			status = B_DEV_NOT_READY;
+			break;
+		}
+		if (device->stopRequested) {
+			device->stopRequested = false;
+			status = B_ERROR;
+			break;
+		}
+
+		bigtime_t now = system_time();
+		if (device->config.reportRate > 0) {
+			if (device->nextReport == 0)
+				device->nextReport = now;
+			if (now < device->nextReport) {
+				wait_until(device, device->nextReport);
+				continue;
+			}
+
+			bigtime_t interval = 1000000 / device->config.reportRate;
+			bigtime_t missed = (now - device->nextReport) / interval;
+			device->stats.missedReports += missed;
+			now = device->nextReport + missed * interval;
+			device->nextReport = now + interval;
+		}
+
+		generate_report(device);
+		device->stats.reports++;
+
+		data->items = extract_items(device, data);
+		if (data->items > 0) {
+			device->stats.records++;
+			data->timestamp = now;
+			data->written = system_time();
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&device->lock);
+	return status;
+}
+
+
+static status_t
+get_layout(mock_device *device, uis_layout_info *layout, size_t length)
+{
+	int32 itemCount = device->config.itemCount;
+	size_t size = sizeof(uis_layout_info) + sizeof(uis_report_layout)
+		+ sizeof(uis_item_layout) * itemCount;
+	if (length < size || layout->size < size) {
+		layout->size = size;
+		return B_BUFFER_OVERFLOW;
+	}
+
+	bool buttons = device->config.pattern == UIS_MOCK_TOGGLE;
+
+	layout->size = size;
+	layout->usage.page = 0x01;
+	layout->usage.id = device->config.relative ? 0x02 : 0x04;
+		// generic desktop mouse or joystick
+	layout->reportCount[UIS_REPORT_TYPE_INPUT] = 1;
+	layout->reportCount[UIS_REPORT_TYPE_OUTPUT] = 0;
+	layout->reportCount[UIS_REPORT_TYPE_FEATURE] = 0;
+	layout->name = kNameId;
+	layout->itemCount = itemCount;
+	layout->vendor = 0;
+	layout->product = 0;
+
+	uis_report_layout *report = (uis_report_layout *) (layout + 1);
+	report->report = device;
+	report->type = UIS_REPORT_TYPE_INPUT;
+	report->id = 1;
+	report->itemCount = itemCount;
+	report->firstItem = 0;
+
+	uis_item_layout *items = (uis_item_layout *) (report + 1);
+	for (int32 i = 0; i < itemCount; i++) {
+		items[i].item = &device->items[i];
+		items[i].usage.page = buttons ? 0x09 : 0x01;
+		items[i].usage.id = buttons ? i + 1 : 0x30 + i;
+		items[i].flags = device->config.relative ? UIS_ITEM_RELATIVE : 0;
+		items[i].minimum = buttons ? 0 : -127;
+		items[i].maximum = buttons ? 1 : 127;
+	}
+
+	return B_OK;
+}
+
+
+static status_t
+device_control(mock_device *device, uint32 op, void *buffer, size_t length)
+{
+	int32 itemCount = device->config.itemCount;
+	bool buttons = device->config.pattern == UIS_MOCK_TOGGLE;
+
+	switch (op) {
+		case UIS_DEVICE_INFO:
+		{
+			uis_device_info *info = (uis_device_info *) buffer;
+			info->usage.page = 0x01;
+			info->usage.id = device->config.relative ? 0x02 : 0x04;
+			info->reportCount[UIS_REPORT_TYPE_INPUT] = 1;
+			info->reportCount[UIS_REPORT_TYPE_OUTPUT] = 0;
+			info->reportCount[UIS_REPORT_TYPE_FEATURE] = 0;
+			info->name = kNameId;
+			return B_OK;
+		}
+
+		case UIS_LAYOUT_INFO:
+			return get_layout(device, (uis_layout_info *) buffer, length);
+
+		case UIS_REPORT_INFO:
+		{
+			uis_report_info *info = (uis_report_info *) buffer;
+			if (info->in.type != UIS_REPORT_TYPE_INPUT || info->in.index != 0)
+				return B_BAD_INDEX;
+			info->out.report = device;
+			info->out.id = 1;
+			info->out.itemCount = itemCount;
+			return B_OK;
+		}
+
+		case UIS_ITEM_INFO:
+		{
+			uis_item_info *info = (uis_item_info *) buffer;
+			int32 index = info->in.index;
+			if (info->in.report != device || index < 0 || index >= itemCount)
+				return B_BAD_INDEX;
+			info->out.item = &device->items[index];
+			info->out.usage.page = buttons ? 0x09 : 0x01;
+			info->out.usage.id = buttons ? index + 1 : 0x30 + index;
+			info->out.isRelative = device->config.relative;
+			return B_OK;
+		}
+
+		case UIS_STRING_INFO:
+		{
+			uis_string_info *info = (uis_string_info *) buffer;
+			if (info->id != kNameId)
+				return B_BAD_VALUE;
+			int32 nameLength = strlen(device->name);
+			info->encoding = B_ISO1_CONVERSION;
+			if (info->string == NULL)
+				info->length = nameLength;
+			else {
+				if (info->length > nameLength)
+					info->length = nameLength;
+				memcpy(info->string, device->name, info->length);
+			}
+			return B_OK;
+		}
+
+		case UIS_READ:
+			return read_report(device, (uis_report_data *) buffer);
+
+		case UIS_STOP:
+			pthread_mutex_lock(&device->lock);
+			device->stopRequested = true;
+			pthread_cond_broadcast(&device->condition);
+			pthread_mutex_unlock(&device->lock);
+			return B_OK;
+
+		case UIS_SET_FILTER:
+		case UIS_GET_FILTER:
+		{
+			uis_item_filter *filter = (uis_item_filter *) buffer;
+			int32 first = filter->index < 0 ? 0 : filter->index;
+			int32 last = filter->index < 0 ? itemCount - 1 : filter->index;
+			if (last >= itemCount)
+				return B_BAD_INDEX;
+
+			pthread_mutex_lock(&device->lock);
+			for (int32 i = first; i <= last; i++) {
+				if (op == UIS_GET_FILTER) {
+					filter->deadzone = device->items[i].deadzone;
+					filter->hysteresis = device->items[i].hysteresis;
+					break;
+				}
+				device->items[i].deadzone = filter->deadzone;
+				device->items[i].hysteresis = filter->hysteresis;
+			}
+			pthread_mutex_unlock(&device->lock);
+			return B_OK;
+		}
+
+		case UIS_GET_VALUE:
+		{
+			uis_item_value *info = (uis_item_value *) buffer;
+			if (info->index < 0 || info->index >= itemCount)
+				return B_BAD_INDEX;
+			pthread_mutex_lock(&device->lock);
+			info->value = device->items[info->index].value;
+			pthread_mutex_unlock(&device->lock);
+			return B_OK;
+		}
+
+		case UIS_SET_INTEREST:
+		{
+			uis_interest_info *info = (uis_interest_info *) buffer;
+			pthread_mutex_lock(&device->lock);
+			for (int32 i = 0; i < itemCount; i++) {
+				device->items[i].interesting = info->mask == NULL
+					|| (i < info->count
+						&& (info->mask[i / 8] & (1 << (i % 8))) != 0);
+			}
+			pthread_mutex_unlock(&device->lock);
+			return B_OK;
+		}
+
+		case UIS_GET_STATS:
+		{
+			uis_stats_info *info = (uis_stats_info *) buffer;
+			pthread_mutex_lock(&device->lock);
+			info->interface = device;
+			memset(&info->device, 0, sizeof(info->device));
+			info->device.transfers = device->stats.reports;
+			info->reports = device->stats;
+			if (info->reset)
+				memset(&device->stats, 0, sizeof(device->stats));
+			pthread_mutex_unlock(&device->lock);
+			return B_OK;
+		}
+	}
+
+	return B_DEV_INVALID_IOCTL;
+}
+
+
+//	#pragma mark -
+
+
+status_t
+uis_mock_create(const uis_mock_config *config, char *path, size_t pathLength)
+{
+	if (config->itemCount < 1 || config->reportRate < 0
+		|| config->pattern < UIS_MOCK_RAMP || config->pattern > UIS_MOCK_TOGGLE)
+		return B_BAD_VALUE;
+
+	mock_device *device = (mock_device *) calloc(1, sizeof(mock_device));
+	if (device == NULL)
+		return B_NO_MEMORY;
+	device->items = (mock_item *) calloc(config->itemCount, sizeof(mock_item));
+	if (device->items == NULL) {
+		free(device);
+		return B_NO_MEMORY;
+	}
+
+	device->config = *config;
+	device->random = config->seed != 0 ? config->seed : 1;
+	pthread_mutex_init(&device->lock, NULL);
+	pthread_cond_init(&device->condition, NULL);
+
+	for (int32 i = 0; i < config->itemCount; i++)
+		device->items[i].interesting = true;
+			// until the reader tells otherwise, like the driver
+
+	pthread_mutex_lock(&sDevicesLock);
+
+	int32 slot = -1;
+	for (int32 i = 0; i < kMaxMockDevices && slot < 0; i++) {
+		int32 candidate = (sNextDevice + i) % kMaxMockDevices;
+		if (sDevices[candidate] == NULL)
+			slot = candidate;
+	}
+	if (slot < 0) {
+		pthread_mutex_unlock(&sDevicesLock);
+		delete_device(device);
+		return B_NO_MORE_FDS;
+	}
+
+	device->slot = slot;
+	snprintf(device->path, sizeof(device->path), "%s%d", kMockPathPrefix,
+		(int) slot);
+	snprintf(device->name, sizeof(device->name), "Mock Device %d", (int) slot);
+	sDevices[slot] = device;
+	sNextDevice = slot + 1;
+
+	pthread_mutex_unlock(&sDevicesLock);
+
+	if (path != NULL)
+		snprintf(path, pathLength, "%s", device->path);
+	return B_OK;
+}
+
+
+/*!	Unplugs a mock device: readers get B_DEV_NOT_READY, and it's gone once
+	the last descriptor is closed.
+*/
+status_t
+uis_mock_remove(const char *path)
+{
+	pthread_mutex_lock(&sDevicesLock);
+
+	mock_device *device = NULL;
+	for (int32 i = 0; i < kMaxMockDevices && device == NULL; i++) {
+		if (sDevices[i] != NULL && !sDevices[i]->removed
+			&& strcmp(sDevices[i]->path, path) == 0)
+			device = sDevices[i];
+	}
+	if (device == NULL) {
+		pthread_mutex_unlock(&sDevicesLock);
+		return B_ENTRY_NOT_FOUND;
+	}
+
+	pthread_mutex_lock(&device->lock);
+	device->removed = true;
+	pthread_cond_broadcast(&device->condition);
+	pthread_mutex_unlock(&device->lock);
+
+	if (device->openCount == 0) {
+		sDevices[device->slot] = NULL;
+		delete_device(device);
+	}
+
+	pthread_mutex_unlock(&sDevicesLock);
+	return B_OK;
+}
+
+
+void
+uis_mock_remove_all()
+{
+	pthread_mutex_lock(&sDevicesLock);
+
+	for (int32 i = 0; i < kMaxMockDevices; i++) {
+		mock_device *device = sDevices[i];
+		if (device == NULL || device->removed)
+			continue;
+
+		pthread_mutex_lock(&device->lock);
+		device->removed = true;
+		pthread_cond_broadcast(&device->condition);
+		pthread_mutex_unlock(&device->lock);
+
+		if (device->openCount == 0) {
+			sDevices[i] = NULL;
+			delete_device(device);
+		}
+	}
+
+	pthread_mutex_unlock(&sDevicesLock);
+}
+
+
+int
+uis_mock_open(const char *path, int mode)
+{
+	if (strncmp(path, kMockPathPrefix, sizeof(kMockPathPrefix) - 1) != 0)
+		return open(path, mode);
+
+	pthread_mutex_lock(&sDevicesLock);
+
+	int fd = -1;
+	for (int32 i = 0; i < kMaxMockDevices; i++) {
+		mock_device *device = sDevices[i];
+		if (device != NULL && !device->removed
+			&& strcmp(device->path, path) == 0) {
+			device->openCount++;
+			fd = kMockDescriptorBase + i;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&sDevicesLock);
+
+	if (fd < 0)
+		errno = B_ENTRY_NOT_FOUND;
+	return fd;
+}
+
+
+int
+uis_mock_close(int fd)
+{
+	if (fd < kMockDescriptorBase)
+		return close(fd);
+
+	pthread_mutex_lock(&sDevicesLock);
+
+	mock_device *device = device_for_descriptor(fd);
+	if (device == NULL) {
+		pthread_mutex_unlock(&sDevicesLock);
+		return set_errno(B_FILE_ERROR);
+	}
+
+	if (--device->openCount == 0 && device->removed) {
+		sDevices[device->slot] = NULL;
+		delete_device(device);
+	}
+
+	pthread_mutex_unlock(&sDevicesLock);
+	return 0;
+}
+
+
+int
+uis_mock_ioctl(int fd, uint32 op, void *buffer, size_t length)
+{
+	if (fd < kMockDescriptorBase)
+		return ioctl(fd, op, buffer, length);
+
+	mock_device *device = device_for_descriptor(fd);
+	if (device == NULL)
+		return set_errno(B_FILE_ERROR);
+
+	return set_errno(device_control(device, op, buffer, length));
+}
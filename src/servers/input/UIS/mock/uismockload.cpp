@@ -0,0 +1,237 @@
+#include <uis_mock_device.h>
+#include <uis_driver.h>
+
+#include <Errors.h>
+#include <OS.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static const int32 kLatencyBuckets = 24;
+	// same log2 buckets as B_UIS_LATENCY_BUCKETS
+
+
+struct reader {
+	int				fd;
+	int32			itemCount;
+	pthread_t		thread;
+	int32			reads;
+	int32			items;
+	int32			latency[kLatencyBuckets];
+	uis_report_stats stats;
+};
+
+
+static void
+usage(const char *program)
+{
+	fprintf(stderr, "usage: %s [-d <devices>] [-r <rate>] [-i <items>] "
+			"[-p ramp|random|toggle] [-c <probability>] [-R] [-t <seconds>]\n"
+		"Reads mock UIS devices the way the input_server does and reports the\n"
+		"throughput and the latency from report to read.\n"
+		"  -d  number of devices (default 100)\n"
+		"  -r  reports per second and device, 0 for unthrottled (default "
+			"1000)\n"
+		"  -i  items per report (default 4)\n"
+		"  -p  how the items change (default ramp)\n"
+		"  -c  change probability of the random pattern (default 0.5)\n"
+		"  -R  relative items\n"
+		"  -t  duration in seconds (default 5)\n", program);
+	exit(1);
+}
+
+
+static void *
+read_reports(void *arg)
+{
+	reader *device = (reader *) arg;
+
+	uis_report_data *data = (uis_report_data *) malloc(
+		sizeof(uis_report_data) + sizeof(uis_item_data) * device->itemCount);
+	if (data == NULL)
+		return NULL;
+
+	while (true) {
+		data->report = NULL;
+		if (uis_mock_ioctl(device->fd, UIS_READ, data, 0) != 0)
+			break;
+
+		bigtime_t latency = system_time() - data->timestamp;
+		int32 bucket = 0;
+		while (latency > 1 && bucket < kLatencyBuckets - 1) {
+			latency >>= 1;
+			bucket++;
+		}
+
+		device->latency[bucket]++;
+		device->reads++;
+		device->items += data->items;
+	}
+
+	free(data);
+	return NULL;
+}
+
+
+static bigtime_t
+percentile(const int32 *buckets, int64 total, double fraction)
+{
+	int64 sum = 0;
+	for (int32 i = 0; i < kLatencyBuckets; i++) {
+		sum += buckets[i];
+		if (sum >= total * fraction)
+			return (2LL << i) - 1;
+	}
+	return 2LL << (kLatencyBuckets - 1);
+}
+
+
+int
+main(int argc, char **argv)
+{
+	int32 deviceCount = 100;
+	int32 seconds = 5;
+	uis_mock_config config;
+	config.reportRate = 1000;
+	config.itemCount = 4;
+	config.pattern = UIS_MOCK_RAMP;
+	config.changeProbability = 0.5f;
+	config.relative = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-R") == 0) {
+			config.relative = true;
+			continue;
+		}
+		if (argv[i][0] != '-' || i + 1 >= argc)
+			usage(argv[0]);
+
+		const char *value = argv[++i];
+		switch (argv[i - 1][1]) {
+			case 'd':
+				deviceCount = atoi(value);
+				break;
+			case 'r':
+				config.reportRate = atoi(value);
+				break;
+			case 'i':
+				config.itemCount = atoi(value);
+				break;
+			case 'c':
+				config.changeProbability = atof(value);
+				break;
+			case 't':
+				seconds = atoi(value);
+				break;
+			case 'p':
+				if (strcmp(value, "ramp") == 0)
+					config.pattern = UIS_MOCK_RAMP;
+				else if (strcmp(value, "random") == 0)
+					config.pattern = UIS_MOCK_RANDOM;
+				else if (strcmp(value, "toggle") == 0)
+					config.pattern = UIS_MOCK_TOGGLE;
+				else
+					usage(argv[0]);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	if (deviceCount < 1 || seconds < 1)
+		usage(argv[0]);
+
+	reader *readers = (reader *) calloc(deviceCount, sizeof(reader));
+	if (readers == NULL)
+		return 1;
+
+	int32 started = 0;
+	for (int32 i = 0; i < deviceCount; i++) {
+		char path[64];
+		config.seed = i + 1;
+		status_t status = uis_mock_create(&config, path, sizeof(path));
+		if (status != B_OK) {
+			fprintf(stderr, "%s: creating device %ld failed: %s\n", argv[0],
+				(long) i, strerror(status));
+			break;
+		}
+
+		reader &device = readers[i];
+		device.fd = uis_mock_open(path, O_RDWR);
+		if (device.fd < 0)
+			break;
+
+		// go through the layout like the input_server does
+		size_t size = sizeof(uis_layout_info);
+		uis_layout_info *layout = (uis_layout_info *) malloc(size);
+		layout->size = size;
+		if (uis_mock_ioctl(device.fd, UIS_LAYOUT_INFO, layout, size) != 0
+			&& errno == B_BUFFER_OVERFLOW) {
+			size = layout->size;
+			layout = (uis_layout_info *) realloc(layout, size);
+			layout->size = size;
+			uis_mock_ioctl(device.fd, UIS_LAYOUT_INFO, layout, size);
+		}
+		device.itemCount = layout->itemCount;
+		free(layout);
+
+		if (pthread_create(&device.thread, NULL, read_reports, &device) != 0) {
+			uis_mock_close(device.fd);
+			break;
+		}
+		started++;
+	}
+
+	bigtime_t start = system_time();
+	snooze(seconds * 1000000LL);
+
+	for (int32 i = 0; i < started; i++) {
+		uis_stats_info info;
+		memset(&info, 0, sizeof(info));
+		info.report = NULL;
+		if (uis_mock_ioctl(readers[i].fd, UIS_GET_STATS, &info, 0) == 0)
+			readers[i].stats = info.reports;
+	}
+
+	uis_mock_remove_all();
+		// readers see B_DEV_NOT_READY and quit
+	bigtime_t elapsed = system_time() - start;
+
+	int64 reads = 0, items = 0, reports = 0, missed = 0;
+	int32 latency[kLatencyBuckets];
+	memset(latency, 0, sizeof(latency));
+
+	for (int32 i = 0; i < started; i++) {
+		pthread_join(readers[i].thread, NULL);
+		uis_mock_close(readers[i].fd);
+
+		reads += readers[i].reads;
+		items += readers[i].items;
+		reports += readers[i].stats.reports;
+		missed += readers[i].stats.missedReports;
+		for (int32 n = 0; n < kLatencyBuckets; n++)
+			latency[n] += readers[i].latency[n];
+	}
+
+	printf("%ld devices, %lld us\n", (long) started, (long long) elapsed);
+	printf("reads:    %lld, %.0f/s\n", (long long) reads,
+		reads * 1000000.0 / elapsed);
+	printf("items:    %lld, %.0f/s\n", (long long) items,
+		items * 1000000.0 / elapsed);
+	printf("reports:  %lld generated, %lld missed\n", (long long) reports,
+		(long long) missed);
+	if (reads > 0) {
+		printf("latency:  p50 < %lld us, p90 < %lld us, p99 < %lld us\n",
+			(long long) percentile(latency, reads, 0.5),
+			(long long) percentile(latency, reads, 0.9),
+			(long long) percentile(latency, reads, 0.99));
+	}
+
+	free(readers);
+	return 0;
+}